@@ -1,11 +1,18 @@
 #include <algorithm>
+#include <bit>
+#include <cstdint>
 #include <format>
+#include <functional>
+#include <limits>
+#include <list>
+#include <map>
 #include <ranges>
 
 #include "ASTNode.hpp"
 #include "Error.hpp"
 #include "Value.hpp"
 #include "WAT.hpp"
+#include "internal_simd_wat.hpp"
 #include "internal_wat.hpp"
 #include "util.hpp"
 
@@ -27,6 +34,10 @@ VarType ASTNode::ReturnType(SymbolTable const &table) const {
     if (literal == "-" && children.size() == 1) {
       return children.at(0).ReturnType(table);
     }
+    // the exponent is always an int
+    if (literal == "**") {
+      return children.at(0).ReturnType(table);
+    }
     // find type based on precision
     if (literal == "+" || literal == "-" || literal == "*" || literal == "/") {
       assert(children.size() == 2);
@@ -79,6 +90,10 @@ VarType ASTNode::ReturnType(SymbolTable const &table) const {
       return VarType::INT;
     } else if (literal == "sqrt") {
       return VarType::DOUBLE;
+    } else if (literal == "finish" || literal == "substr") {
+      return VarType::STRING;
+    } else if (literal == "append" || literal == "reserve") {
+      return VarType::NONE;
     }
     assert(false);
   }
@@ -109,7 +124,688 @@ bool ASTNode::HasReturn(State const &state) const {
   }
 }
 
+void ASTNode::CollectEffects(LoopEffects &effects,
+                             SymbolTable const &table) const {
+  if (type == ASSIGN) {
+    if (children.at(0).type == IDENTIFIER) {
+      effects.assigned.insert(children.at(0).var_id);
+    } else {
+      effects.string_writes = true;
+    }
+  } else if (type == BUILT_IN_FUNCTION_CALL &&
+             (literal == "append" || literal == "reserve" ||
+              literal == "finish")) {
+    // these update the builder variable they're given
+    effects.assigned.insert(children.at(0).var_id);
+  } else if (type == FUNCTION_CALL) {
+    // heap strings are passed by reference, so the callee may index-assign
+    // into any string we give it (or anything aliasing it)
+    if (std::ranges::any_of(children, [&table](ASTNode const &child) {
+          return child.ReturnType(table).IsRefCounted();
+        })) {
+      effects.string_writes = true;
+    }
+  }
+  for (ASTNode const &child : children) {
+    child.CollectEffects(effects, table);
+  }
+}
+
+bool ASTNode::IsInvariant(LoopEffects const &effects,
+                          State const &state) const {
+  if (state.hoisted.contains(this)) {
+    return true;
+  }
+  auto children_invariant = [&]() {
+    return std::ranges::all_of(children, [&](ASTNode const &child) {
+      return child.IsInvariant(effects, state);
+    });
+  };
+  switch (type) {
+  case LITERAL:
+    return true;
+  case IDENTIFIER:
+    return !effects.assigned.contains(var_id);
+  case OPERATION:
+    // string-valued operations allocate a new string every time
+    if (ReturnType(state.table) == VarType::STRING) {
+      return false;
+    }
+    // string comparisons read string contents
+    if (std::ranges::any_of(children, [&](ASTNode const &child) {
+          return child.ReturnType(state.table) == VarType::STRING;
+        }) &&
+        effects.string_writes) {
+      return false;
+    }
+    return children_invariant();
+  case CAST_INT:
+  case CAST_DOUBLE:
+    return children_invariant();
+  case BUILT_IN_FUNCTION_CALL:
+    // like string operations, substr() makes a new string every time
+    if (ReturnType(state.table) == VarType::STRING) {
+      return false;
+    }
+    // size() reads the length header, which indexed assignment never changes
+    return children_invariant();
+  case STRING_INDEX:
+    return !effects.string_writes && children_invariant();
+  default:
+    return false;
+  }
+}
+
+bool ASTNode::MayTrap(SymbolTable const &table) const {
+  switch (type) {
+  case OPERATION:
+    if ((literal == "/" || literal == "%") &&
+        ReturnType(table) == VarType::INT) {
+      return true;
+    }
+    break;
+  case CAST_INT:
+    if (children.at(0).ReturnType(table) == VarType::DOUBLE) {
+      return true;
+    }
+    break;
+  case BUILT_IN_FUNCTION_CALL:
+    if (literal == "size" || literal == "substr") {
+      return true;
+    }
+    break;
+  case STRING_INDEX:
+    return true;
+  default:
+    break;
+  }
+  return std::ranges::any_of(children, [&table](ASTNode const &child) {
+    return child.MayTrap(table);
+  });
+}
+
+bool ASTNode::IsBranchFree(State const &state) const {
+  // simple arithmetic on numbers, which can be computed whether it's needed or
+  // not without a branch or any chance of trapping
+  if (state.hoisted.contains(this)) {
+    return true;
+  }
+  VarType node_type = ReturnType(state.table);
+  if (node_type != VarType::INT && node_type != VarType::CHAR &&
+      node_type != VarType::DOUBLE) {
+    return false;
+  }
+  switch (type) {
+  case IDENTIFIER:
+  case LITERAL:
+    return true;
+  case OPERATION:
+    if (literal == "&&" || literal == "||" || literal == "!" ||
+        literal == "**") {
+      return false;
+    }
+    [[fallthrough]];
+  case CAST_INT:
+  case CAST_DOUBLE:
+    return !MayTrap(state.table) &&
+           std::ranges::all_of(children, [&state](ASTNode const &child) {
+             return child.IsBranchFree(state);
+           });
+  default:
+    return false;
+  }
+}
+
+size_t ASTNode::Size() const {
+  size_t size = 1;
+  for (ASTNode const &child : children) {
+    size += child.Size();
+  }
+  return size;
+}
+
+bool ASTNode::Contains(Type node_type) const {
+  return type == node_type ||
+         std::ranges::any_of(children, [node_type](ASTNode const &child) {
+           return child.Contains(node_type);
+         });
+}
+
+bool ASTNode::Calls(size_t function_id, bool count_tail_calls) const {
+  if (type == FUNCTION_CALL && var_id == function_id) {
+    return true;
+  }
+  if (!count_tail_calls && type == RETURN &&
+      children.at(0).type == FUNCTION_CALL &&
+      children.at(0).var_id == function_id) {
+    // a tail call itself doesn't count, only calls among its arguments
+    return std::ranges::any_of(children.at(0).children,
+                               [function_id](ASTNode const &child) {
+                                 return child.Calls(function_id, false);
+                               });
+  }
+  return std::ranges::any_of(children, [&](ASTNode const &child) {
+    return child.Calls(function_id, count_tail_calls);
+  });
+}
+
+bool ASTNode::IsPure(State const &state, size_t function_id) const {
+  // indexed assignment writes into a string someone else may share
+  if (type == ASSIGN && children.at(0).type != IDENTIFIER) {
+    return false;
+  }
+  if (type == FUNCTION_CALL && var_id != function_id &&
+      !state.pure_functions.contains(var_id)) {
+    return false;
+  }
+  return std::ranges::all_of(children, [&](ASTNode const &child) {
+    return child.IsPure(state, function_id);
+  });
+}
+
+// memo tables have this many entries, indexed by the one int parameter or
+// by both of two (each then below 64)
+static constexpr size_t MEMO_ENTRIES = 4096;
+
+bool ASTNode::CanMemoize(State const &state) const {
+  FunctionInfo const &info = state.table.functions.at(var_id);
+  VarType rettype = info.rettype;
+  // self calls in tail position already run as a loop, and remembering the
+  // result of each step wouldn't save anything
+  return state.pure_functions.contains(var_id) && Calls(var_id, false) &&
+         (info.parameters == 1 || info.parameters == 2) &&
+         std::ranges::all_of(
+             info.variables | std::views::take(info.parameters),
+             [&state](size_t id) {
+               return state.table.variables.at(id).type_var == VarType::INT;
+             }) &&
+         (rettype == VarType::INT || rettype == VarType::CHAR ||
+          rettype == VarType::DOUBLE);
+}
+
+void ASTNode::CountCalls(State &state) const {
+  if (type == FUNCTION) {
+    state.function_nodes[var_id] = this;
+  } else if (type == FUNCTION_CALL) {
+    state.call_sites[var_id]++;
+  }
+  for (ASTNode const &child : children) {
+    child.CountCalls(state);
+  }
+}
+
+// clones bigger than this aren't made, and all of them together stay within
+// the total
+static constexpr size_t SPECIALIZE_MAX_SIZE = 200;
+static constexpr size_t SPECIALIZE_BUDGET = 4000;
+
+void ASTNode::SpecializeCalls(State &state) {
+  assert(type == MODULE);
+  // a call with constant arguments goes to a copy of the callee with those
+  // arguments filled in and folded through its body. Calls with the same
+  // constants share a copy, which is placed after the original
+  std::unordered_map<size_t, ASTNode const *> definitions{};
+  for (ASTNode const &child : children) {
+    if (child.type == FUNCTION) {
+      definitions[child.var_id] = &child;
+    }
+  }
+  std::unordered_map<size_t, std::list<ASTNode>> copies{};
+  // each set of constants seen so far and the copy made for it, if any
+  std::unordered_map<std::string, std::optional<size_t>> made{};
+  size_t budget = SPECIALIZE_BUDGET;
+  // functions whose copies are being visited. Those copies may call the
+  // copies already made, but making more would follow the recursion (each
+  // Fib(n) making Fib(n - 1) and Fib(n - 2)) through the whole call tree
+  std::set<size_t> visiting{};
+
+  std::function<void(ASTNode &)> visit = [&](ASTNode &node) {
+    for (ASTNode &child : node.children) {
+      visit(child);
+    }
+    if (node.type != FUNCTION_CALL) {
+      return;
+    }
+
+    // parameters the callee assigns to can't be replaced by constants
+    ASTNode const &callee = *definitions.at(node.var_id);
+    FunctionInfo const info = state.table.functions.at(node.var_id);
+    LoopEffects effects{};
+    callee.CollectEffects(effects, state.table);
+    std::unordered_map<size_t, Value> constants{};
+    std::string key = std::to_string(node.var_id);
+    for (size_t i = 0; i < info.parameters; ++i) {
+      ASTNode const &arg = node.children.at(i);
+      size_t param = info.variables.at(i);
+      if (arg.type == LITERAL && arg.value->getType() != VarType::STRING &&
+          !effects.assigned.contains(param)) {
+        constants.emplace(param, arg.value.value());
+        // formatted exactly, so doubles that differ past the sixth decimal
+        // get copies of their own
+        key += std::visit(
+            [i](auto value) { return std::format(" {}={}", i, value); },
+            arg.value->getVariant());
+      }
+    }
+    if (constants.empty()) {
+      return;
+    }
+
+    size_t root = info.specialization_of.value_or(node.var_id);
+    if (!made.contains(key) && !visiting.contains(root)) {
+      made[key] = std::nullopt;
+      size_t size = callee.Size();
+      if (size > SPECIALIZE_MAX_SIZE) {
+        return;
+      }
+      // the copy gets locals of its own, so that it can be inlined into a
+      // function it was copied from
+      std::unordered_map<size_t, size_t> renamed{};
+      std::vector<size_t> variables{};
+      for (size_t id : info.variables) {
+        if (!constants.contains(id)) {
+          renamed[id] = state.table.variables.size() + variables.size();
+          variables.push_back(renamed.at(id));
+        }
+      }
+      // a copy is only worth it if folding the constants removed something
+      ASTNode copy = callee.Specialize(constants, renamed);
+      if (copy.Size() >= size || copy.Size() > budget) {
+        return;
+      }
+      budget -= copy.Size();
+
+      for (size_t id : info.variables) {
+        if (!constants.contains(id)) {
+          state.table.variables.push_back(state.table.variables.at(id));
+        }
+      }
+      FunctionInfo copy_info = info;
+      copy_info.name += std::format(".{}", state.table.functions.size());
+      copy_info.specialization_of = root;
+      copy_info.parameters -= constants.size();
+      copy_info.variables = std::move(variables);
+      copy.var_id = state.table.functions.size();
+      state.table.functions.push_back(std::move(copy_info));
+      made[key] = copy.var_id;
+
+      std::list<ASTNode> &list = copies[root];
+      list.push_back(std::move(copy));
+      definitions[list.back().var_id] = &list.back();
+      // calls in the copy may now have constant arguments too, including
+      // recursive calls that end up back at the copy itself
+      visiting.insert(root);
+      visit(list.back());
+      visiting.erase(root);
+    }
+    if (!made.contains(key)) {
+      return;
+    }
+    if (!made.at(key)) {
+      return;
+    }
+
+    std::vector<ASTNode> args{};
+    for (size_t i = 0; i < node.children.size(); ++i) {
+      if (!constants.contains(info.variables.at(i))) {
+        args.push_back(std::move(node.children[i]));
+      }
+    }
+    node.children = std::move(args);
+    node.var_id = made.at(key).value();
+  };
+  for (ASTNode &child : children) {
+    visit(child);
+  }
+
+  std::vector<ASTNode> functions{};
+  for (ASTNode &child : children) {
+    size_t id = child.var_id;
+    bool is_function = child.type == FUNCTION;
+    functions.push_back(std::move(child));
+    if (is_function && copies.contains(id)) {
+      std::ranges::move(copies.at(id), std::back_inserter(functions));
+    }
+  }
+  children = std::move(functions);
+}
+
+ASTNode
+ASTNode::Specialize(std::unordered_map<size_t, Value> const &constants,
+                    std::unordered_map<size_t, size_t> const &renamed) const {
+  ASTNode out{type};
+  if (value) {
+    out.value.emplace(value.value());
+  }
+  out.var_id = var_id;
+  out.literal = literal;
+  if (type == IDENTIFIER) {
+    if (auto found = constants.find(var_id); found != constants.end()) {
+      return ASTNode{LITERAL, Value{found->second}};
+    }
+    if (auto found = renamed.find(var_id); found != renamed.end()) {
+      out.var_id = found->second;
+    }
+  }
+  for (ASTNode const &child : children) {
+    out.children.push_back(child.Specialize(constants, renamed));
+  }
+  return Fold(std::move(out));
+}
+
+// the same as $_pow_i32 in internal.wat, for folding constants
+static int32_t IntPower(int32_t base, int32_t exp) {
+  if (exp < 0) {
+    if (base == -1) {
+      return exp % 2 == 0 ? 1 : -1;
+    }
+    return base == 1;
+  }
+  uint32_t result = 1;
+  uint32_t square = static_cast<uint32_t>(base);
+  for (uint32_t bits = static_cast<uint32_t>(exp); bits != 0; bits >>= 1) {
+    if (bits & 1) {
+      result *= square;
+    }
+    square *= square;
+  }
+  return static_cast<int32_t>(result);
+}
+
+ASTNode ASTNode::Fold(ASTNode node) {
+  auto int_value = [](ASTNode const &child) -> std::optional<int> {
+    if (child.type == LITERAL && child.value->getType() == VarType::INT) {
+      return std::get<int>(child.value->getVariant());
+    }
+    return std::nullopt;
+  };
+  auto int_literal = [](int32_t value) {
+    return ASTNode{LITERAL, Value{static_cast<int>(value)}};
+  };
+
+  switch (node.type) {
+  case OPERATION: {
+    // int arithmetic wraps around like i32, and anything that would trap is
+    // left for run time
+    std::optional<int> left = int_value(node.children.at(0));
+    if (!left) {
+      break;
+    }
+    uint32_t const a = static_cast<uint32_t>(left.value());
+    if (node.children.size() == 1) {
+      if (node.literal == "!") {
+        return int_literal(left.value() == 0);
+      } else if (node.literal == "-") {
+        return int_literal(static_cast<int32_t>(0u - a));
+      }
+      break;
+    }
+    // && and || don't evaluate their right side when the left decides
+    if (node.literal == "&&" && left.value() == 0) {
+      return int_literal(0);
+    } else if (node.literal == "||" && left.value() != 0) {
+      return int_literal(1);
+    }
+    std::optional<int> right = int_value(node.children.at(1));
+    if (!right) {
+      break;
+    }
+    uint32_t const b = static_cast<uint32_t>(right.value());
+    int const x = left.value();
+    int const y = right.value();
+    std::string const &op = node.literal;
+    if (op == "+") {
+      return int_literal(static_cast<int32_t>(a + b));
+    } else if (op == "-") {
+      return int_literal(static_cast<int32_t>(a - b));
+    } else if (op == "*") {
+      return int_literal(static_cast<int32_t>(a * b));
+    } else if (op == "/" && y != 0 &&
+               !(x == std::numeric_limits<int>::min() && y == -1)) {
+      return int_literal(x / y);
+    } else if (op == "%" && b != 0) {
+      return int_literal(static_cast<int32_t>(a % b));
+    } else if (op == "**") {
+      return int_literal(IntPower(x, y));
+    } else if (op == "<") {
+      return int_literal(x < y);
+    } else if (op == ">") {
+      return int_literal(x > y);
+    } else if (op == "<=") {
+      return int_literal(x <= y);
+    } else if (op == ">=") {
+      return int_literal(x >= y);
+    } else if (op == "==") {
+      return int_literal(x == y);
+    } else if (op == "!=") {
+      return int_literal(x != y);
+    } else if (op == "&&") {
+      return int_literal(x != 0 && y != 0);
+    } else if (op == "||") {
+      return int_literal(x != 0 || y != 0);
+    }
+    break;
+  }
+  case CONDITIONAL:
+    // keep only the branch that's taken
+    if (std::optional<int> condition = int_value(node.children.at(0))) {
+      size_t branch = condition.value() != 0 ? 1 : 2;
+      if (branch < node.children.size()) {
+        return std::move(node.children[branch]);
+      }
+      return ASTNode{EMPTY};
+    }
+    break;
+  case WHILE:
+    if (int_value(node.children.at(0)) == 0) {
+      return ASTNode{EMPTY};
+    }
+    break;
+  case SCOPE:
+  case FUNCTION: {
+    // a branch that's always taken may have left a return in the middle
+    auto ret = std::ranges::find_if(node.children, [](ASTNode const &child) {
+      return child.type == RETURN;
+    });
+    if (ret != node.children.end() && std::next(ret) != node.children.end()) {
+      std::vector<ASTNode> kept{};
+      std::move(node.children.begin(), std::next(ret),
+                std::back_inserter(kept));
+      node.children = std::move(kept);
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  return node;
+}
+
+void ASTNode::FindInvariants(LoopEffects const &effects, State const &state,
+                             bool may_trap,
+                             std::vector<ASTNode const *> &out) const {
+  if (state.hoisted.contains(this)) {
+    return;
+  }
+  // literals and variables are already as cheap as the local we'd hoist into
+  if (type != LITERAL && type != IDENTIFIER && IsInvariant(effects, state) &&
+      (may_trap || !MayTrap(state.table))) {
+    out.push_back(this);
+    return;
+  }
+
+  switch (type) {
+  case ASSIGN:
+    // the target of an assignment is not an expression we can replace, but
+    // the string and index of an indexed assignment are
+    if (children.at(0).type == STRING_INDEX) {
+      for (ASTNode const &child : children.at(0).children) {
+        child.FindInvariants(effects, state, may_trap, out);
+      }
+    }
+    children.at(1).FindInvariants(effects, state, may_trap, out);
+    return;
+  case OPERATION:
+    // the right side of && and || only runs conditionally
+    if (literal == "&&" || literal == "||") {
+      children.at(0).FindInvariants(effects, state, may_trap, out);
+      children.at(1).FindInvariants(effects, state, false, out);
+      return;
+    }
+    break;
+  case CONDITIONAL:
+  case WHILE:
+    children.at(0).FindInvariants(effects, state, may_trap, out);
+    for (ASTNode const &child : children | std::views::drop(1)) {
+      child.FindInvariants(effects, state, false, out);
+    }
+    return;
+  default:
+    break;
+  }
+  for (ASTNode const &child : children) {
+    child.FindInvariants(effects, state, may_trap, out);
+  }
+}
+
+size_t ASTNode::CountAssigns(size_t id) const {
+  size_t count = type == ASSIGN && children.at(0).type == IDENTIFIER &&
+                 children.at(0).var_id == id;
+  for (ASTNode const &child : children) {
+    count += child.CountAssigns(id);
+  }
+  return count;
+}
+
+std::optional<LoopCounter> ASTNode::FindCounter(State const &state) const {
+  assert(type == WHILE);
+  // the loop must be "while (i < bound) { ...; i = i + step; }", the only
+  // assignment to i, with the bound not changing
+  ASTNode const &condition = children.at(0);
+  if (condition.type != OPERATION || condition.children.size() != 2 ||
+      (condition.literal != "<" && condition.literal != "<=" &&
+       condition.literal != ">" && condition.literal != ">=")) {
+    return std::nullopt;
+  }
+  ASTNode const &var = condition.children.at(0);
+  ASTNode const &bound = condition.children.at(1);
+  if (var.type != IDENTIFIER || var.ReturnType(state.table) != VarType::INT ||
+      bound.ReturnType(state.table) != VarType::INT ||
+      CountAssigns(var.var_id) != 1) {
+    return std::nullopt;
+  }
+  LoopEffects effects{};
+  CollectEffects(effects, state.table);
+  if (!bound.IsInvariant(effects, state)) {
+    return std::nullopt;
+  }
+
+  ASTNode const &body = children.at(1);
+  ASTNode const &last = body.type == SCOPE && !body.children.empty()
+                            ? body.children.back()
+                            : body;
+  if (last.type != ASSIGN || last.children.at(0).type != IDENTIFIER ||
+      last.children.at(0).var_id != var.var_id) {
+    return std::nullopt;
+  }
+  ASTNode const &next = last.children.at(1);
+  if (next.type != OPERATION || next.children.size() != 2 ||
+      (next.literal != "+" && next.literal != "-")) {
+    return std::nullopt;
+  }
+  auto is_var = [&var](ASTNode const &node) {
+    return node.type == IDENTIFIER && node.var_id == var.var_id;
+  };
+  auto step_of = [](ASTNode const &node) -> std::optional<int32_t> {
+    if (node.type == LITERAL && node.value->getType() == VarType::INT) {
+      return std::get<int>(node.value->getValue());
+    }
+    return std::nullopt;
+  };
+  std::optional<int32_t> step = std::nullopt;
+  if (is_var(next.children.at(0))) {
+    step = step_of(next.children.at(1));
+  } else if (next.literal == "+" && is_var(next.children.at(1))) {
+    step = step_of(next.children.at(0));
+  }
+  if (!step || *step == 0 || *step == std::numeric_limits<int32_t>::min()) {
+    return std::nullopt;
+  }
+  if (next.literal == "-") {
+    step = -*step;
+  }
+  // the counter has to move towards the bound
+  bool const counts_up = condition.literal == "<" || condition.literal == "<=";
+  if (counts_up != (*step > 0)) {
+    return std::nullopt;
+  }
+  return LoopCounter{var.var_id, condition.literal, *step};
+}
+
+bool ASTNode::CanUnroll() const {
+  // every iteration must run to the end, and copies of the body must stay
+  // as small as they look
+  return !Contains(CONTINUE) && !Contains(BREAK) &&
+         !children.at(1).Contains(WHILE) && !Contains(FUNCTION_CALL);
+}
+
+bool ASTNode::CollectConstantAssigns(size_t id,
+                                     std::vector<int32_t> &values) const {
+  if (type == ASSIGN && children.at(0).type == IDENTIFIER &&
+      children.at(0).var_id == id) {
+    ASTNode const &value = children.at(1);
+    if (value.type != LITERAL || value.value->getType() != VarType::INT) {
+      return false;
+    }
+    values.push_back(std::get<int>(value.value->getValue()));
+  }
+  return std::ranges::all_of(children, [id, &values](ASTNode const &child) {
+    return child.CollectConstantAssigns(id, values);
+  });
+}
+
+std::optional<std::pair<int32_t, int32_t>>
+ASTNode::CounterStart(size_t index, State const &state) const {
+  // the lowest and highest value the loop's counter can start at, when an
+  // earlier statement in the same block sets it to a constant and the ones
+  // in between only set it to constants
+  std::optional<LoopCounter> counter = children.at(index).FindCounter(state);
+  if (!counter) {
+    return std::nullopt;
+  }
+  std::vector<int32_t> values{};
+  for (size_t i = index; i-- > 0;) {
+    ASTNode const &statement = children.at(i);
+    if (!statement.CollectConstantAssigns(counter->var_id, values)) {
+      return std::nullopt;
+    }
+    if (statement.type == ASSIGN &&
+        statement.children.at(0).type == IDENTIFIER &&
+        statement.children.at(0).var_id == counter->var_id) {
+      auto [low, high] = std::ranges::minmax(values);
+      return std::pair{low, high};
+    }
+  }
+  return std::nullopt;
+}
+
+bool ASTNode::IsInBounds(State const &state) const {
+  assert(type == STRING_INDEX);
+  ASTNode const &str = children.at(0);
+  ASTNode const &index = children.at(1);
+  if (str.type != IDENTIFIER || index.type != IDENTIFIER) {
+    return false;
+  }
+  auto found = state.in_bounds.find(index.var_id);
+  return found != state.in_bounds.end() && found->second == str.var_id;
+}
+
 std::vector<WATExpr> ASTNode::Emit(State &state) const {
+  // expressions hoisted out of a loop have already been computed
+  if (auto hoisted = state.hoisted.find(this); hoisted != state.hoisted.end()) {
+    return WATExpr{"local.get", Variable("var", hoisted->second)};
+  }
+
   switch (type) {
   case SCOPE:
     return EmitScope(state);
@@ -138,8 +834,7 @@ std::vector<WATExpr> ASTNode::Emit(State &state) const {
   case STRING_INDEX:
     return EmitStringIndex(state);
   case RETURN:
-    assert(children.size() == 1);
-    return WATExpr{"return", children.at(0).Emit(state)};
+    return EmitReturn(state);
   case CAST_INT: {
     assert(children.size() == 1);
     std::vector<WATExpr> ret = children.at(0).Emit(state);
@@ -177,46 +872,290 @@ std::vector<WATExpr> ASTNode::Emit(State &state) const {
   };
 }
 
+// String values follow a simple ownership convention. Every string-valued
+// expression produces a reference its user owns, and must eventually either
+// store it in a variable (which then owns it) or release it. Runtime
+// functions only borrow the strings they're given, so variables and literals
+// can be passed to them directly, while temporaries are released right after
+// the call. Functions own their parameters, and release every string
+// variable before returning. Builders are strings at run time, and follow
+// the same rules.
+
+std::vector<WATExpr> ASTNode::EmitOwned(State &state) const {
+  if (type == ASSIGN) {
+    std::vector<WATExpr> out = EmitAssign(state, true);
+    // the variable keeps its reference, so take another one for our user
+    if (children.at(0).ReturnType(state.table).IsRefCounted()) {
+      return WATExpr{"call", Variable("_str_retain"), std::move(out)};
+    }
+    return out;
+  }
+  if ((type == IDENTIFIER || state.hoisted.contains(this)) &&
+      ReturnType(state.table).IsRefCounted()) {
+    return WATExpr{"call", Variable("_str_retain"), Emit(state)};
+  }
+  return Emit(state);
+}
+
+std::vector<WATExpr> ASTNode::EmitBorrowed(State &state,
+                                           std::vector<WATExpr> &cleanup) const {
+  if (type == ASSIGN) {
+    return EmitAssign(state, true);
+  }
+  if (!ReturnType(state.table).IsRefCounted() || type == IDENTIFIER ||
+      type == LITERAL || state.hoisted.contains(this)) {
+    return Emit(state);
+  }
+  // hold on to the temporary so it can be released once it's been used
+  size_t temp = state.AddTemp("_string", ReturnType(state.table));
+  cleanup.push_back(WATExpr{"call", Variable("_str_release"),
+                            WATExpr{"local.get", Variable("var", temp)}});
+  return WATExpr{"local.tee", Variable("var", temp), Emit(state)};
+}
+
+std::vector<WATExpr> ASTNode::EmitReleaseLocals(State &state) const {
+  std::vector<WATExpr> out{};
+  for (size_t var_id : state.table.functions.at(state.function_id).variables) {
+    VariableInfo const &var = state.table.variables.at(var_id);
+    if (var.type_var.IsRefCounted() && !var.is_temp) {
+      out.push_back(WATExpr{"call", Variable("_str_release"),
+                            WATExpr{"local.get", Variable("var", var_id)}});
+    }
+  }
+  return out;
+}
+
+std::vector<WATExpr> ASTNode::EmitReturn(State &state) const {
+  assert(children.size() == 1);
+  if (auto out = EmitTailCall(state)) {
+    return std::move(out.value());
+  }
+  // the return value is computed before releasing variables, so returning
+  // one of them still works
+  std::vector<WATExpr> out = children.at(0).EmitOwned(state);
+  std::ranges::move(EmitReleaseLocals(state), std::back_inserter(out));
+  if (state.inline_exit) {
+    out.emplace_back("br", state.inline_exit.value());
+  } else {
+    out.emplace_back("return");
+  }
+  return out;
+}
+
+std::optional<std::vector<WATExpr>>
+ASTNode::EmitTailCall(State &state) const {
+  ASTNode const &call = children.at(0);
+  bool is_self = call.var_id == state.function_id;
+  if (call.type != FUNCTION_CALL || state.hoisted.contains(&call) ||
+      state.inline_exit ||
+      (!is_self && (!state.options.tail_calls || call.ShouldInline(state)))) {
+    return std::nullopt;
+  }
+
+  // the arguments stay on the stack while our variables are released, since
+  // nothing of ours is needed once the call starts
+  std::vector<WATExpr> out{};
+  for (ASTNode const &child : call.children) {
+    std::ranges::move(child.EmitOwned(state), std::back_inserter(out));
+  }
+  std::ranges::move(EmitReleaseLocals(state), std::back_inserter(out));
+  if (!is_self) {
+    state.calls[state.outer_function_id].insert(call.var_id);
+    out.emplace_back("return_call",
+                     Variable(state.table.functions.at(call.var_id).name));
+    return out;
+  }
+
+  // calling ourselves starts the body over: locals go back to zero as in a
+  // new call, and the arguments (last one on top) become the parameters
+  FunctionInfo const &info = state.table.functions.at(state.function_id);
+  for (size_t var_id : info.variables | std::views::drop(info.parameters)) {
+    VarType var_type = state.table.variables.at(var_id).type_var;
+    out.push_back(WATExpr{"local.set", Variable("var", var_id),
+                          WATExpr{var_type.WATOperation("const"), "0"}});
+  }
+  for (size_t var_id :
+       info.variables | std::views::take(info.parameters) | std::views::reverse) {
+    out.emplace_back("local.set", Variable("var", var_id));
+  }
+  out.emplace_back("br", "$tail_call");
+  state.self_tail_call = true;
+  return out;
+}
+
 WATExpr ASTNode::EmitModule(State &state) const {
   assert(type == ASTNode::MODULE);
   WATExpr out{"module"};
   WATParser parser{internal_wat, internal_wat_len};
   std::vector<WATExpr> internal_funcs = parser.Parse();
+  if (state.options.simd) {
+    // swap in the SIMD versions of any runtime functions that have one
+    WATParser simd_parser{internal_simd_wat, internal_simd_wat_len};
+    for (WATExpr &simd_func : simd_parser.Parse()) {
+      auto same_name = [&simd_func](WATExpr const &func) {
+        return std::get<std::string>(func.children.at(0)) ==
+               std::get<std::string>(simd_func.children.at(0));
+      };
+      std::ranges::replace_if(internal_funcs, same_name, simd_func);
+    }
+  }
   bool injected = false;
-  // write memory declaration and export
-  out.Child("memory", WATExpr("export", Quote("memory")).Inline(), "1");
+  CountCalls(state);
+  for (std::string const &name : state.options.exports) {
+    if (std::ranges::none_of(state.table.functions,
+                             [&name](FunctionInfo const &func) {
+                               return func.name == name;
+                             })) {
+      ErrorNoLine("Unknown function '", name, "' in --export");
+    }
+  }
+  // one free list per possible size class of a 32-bit length
+  // every single-character string, 12 bytes each (header, char, null, padding)
+  size_t char_table = state.AddStatic(256 * 12);
+  size_t static_end = state.string_pos;
+  size_t free_lists = state.AddStatic(32 * 4);
+  // find the functions without side effects (callees come first), and give
+  // each one worth memoizing a table of zeroed entries: a filled flag, then
+  // the result
+  for (ASTNode const &child : children) {
+    if (child.type == ASTNode::FUNCTION &&
+        child.IsPure(state, child.var_id)) {
+      state.pure_functions.insert(child.var_id);
+      if (state.options.memoize && child.CanMemoize(state)) {
+        bool is_double =
+            state.table.functions.at(child.var_id).rettype == VarType::DOUBLE;
+        state.memo_tables[child.var_id] =
+            state.AddStatic(MEMO_ENTRIES * (is_double ? 16 : 8));
+      }
+    }
+  }
+
+  // write memory declaration and export; memory must at least hold the
+  // string literals, and the heap grows from there
+  size_t const page_size = 65536;
+  size_t static_pages = (state.string_pos + page_size - 1) / page_size;
+  size_t initial_pages = std::max(state.options.initial_pages, static_pages);
+  WATExpr &memory =
+      out.Child("memory", WATExpr("export", Quote("memory")).Inline(),
+                std::to_string(initial_pages));
+  if (state.options.max_pages) {
+    if (state.options.max_pages.value() < static_pages) {
+      ErrorNoLine("String literals need ", static_pages,
+                  " pages of memory, but the maximum is ",
+                  state.options.max_pages.value());
+    }
+    memory.Push(std::to_string(state.options.max_pages.value()));
+  }
 
-  // write string literals
-  size_t current_free = 0;
-  for (std::string const &literal : state.string_literals) {
-    out.Child("data")
-        .Push(WATExpr("i32.const", std::to_string(current_free)).Inline())
-        .Push(Quote(literal + "\\00"));
-    current_free += literal.size() + 1;
+  // write all static strings as a single data segment: the literals, each
+  // preceded by a zero reference count (so it's never freed) and its length,
+  // followed by the table of single-character strings
+  std::string data(static_end, '\0');
+  auto write_string = [&data](size_t pos, std::string const &text) {
+    uint32_t length = static_cast<uint32_t>(text.size());
+    for (size_t byte = 0; byte < 4; ++byte) {
+      data[pos - 4 + byte] = static_cast<char>((length >> (8 * byte)) & 0xff);
+    }
+    data.replace(pos, text.size(), text);
+  };
+  for (StringLiteral const &literal : state.string_literals) {
+    write_string(literal.pos, literal.text);
+  }
+  for (size_t chr = 0; chr < 256; ++chr) {
+    write_string(char_table + 12 * chr + 8,
+                 std::string(1, static_cast<char>(chr)));
   }
+  out.Child("data")
+      .Push(WATExpr("i32.const", "0").Inline())
+      .Push(QuoteBytes(data));
+  out.Child("global", Variable("_char_strings"), "i32")
+      .Newline()
+      .Child("i32.const", std::to_string(char_table + 8))
+      .Inline();
+
+  // write location of the free list heads for each string size class
+  out.Child("global", Variable("_free_lists"), "i32")
+      .Newline()
+      .Child("i32.const", std::to_string(free_lists))
+      .Inline();
+
+  // write start of the heap, which heap_reset never goes below
+  out.Child("global", Variable("_heap_base"), "i32")
+      .Newline()
+      .Child("i32.const", std::to_string(state.string_pos))
+      .Inline();
 
   // write free memory position variable
   WATExpr &global = out.Child("global", Variable("_free")).Newline();
   global.Child("mut", "i32").Inline();
   global.Child("i32.const", std::to_string(state.string_pos)).Inline();
 
+  // write the last heap mark taken or reset to; blocks before it aren't
+  // handed out again while it's in effect
+  WATExpr &mark = out.Child("global", Variable("_mark")).Newline();
+  mark.Child("mut", "i32").Inline();
+  mark.Child("i32.const", "0").Inline();
+
   // generate function body
+  std::vector<std::vector<WATExpr>> code{};
   for (ASTNode const &child : children) {
+    code.push_back(child.Emit(state));
+  }
+
+  // functions that aren't exported are only needed if a function we keep
+  // still calls them
+  std::unordered_set<size_t> needed{};
+  std::vector<size_t> unvisited{};
+  for (size_t id = 0; id < state.table.functions.size(); ++id) {
+    if (state.IsExported(state.table.functions.at(id))) {
+      needed.insert(id);
+      unvisited.push_back(id);
+    }
+  }
+  while (!unvisited.empty()) {
+    size_t id = unvisited.back();
+    unvisited.pop_back();
+    for (size_t callee : state.calls[id]) {
+      if (needed.insert(callee).second) {
+        unvisited.push_back(callee);
+      }
+    }
+  }
+  for (size_t i = 0; i < children.size(); ++i) {
+    ASTNode const &child = children[i];
     // inject our functions before writing user-defined functions
     if (!injected && child.type == ASTNode::FUNCTION) {
       out.Push(std::move(internal_funcs));
       injected = true;
     }
 
-    out.Push(child.Emit(state));
+    if (child.type != ASTNode::FUNCTION || needed.contains(child.var_id)) {
+      out.Push(std::move(code[i]));
+    }
   }
 
   // generate exports for functions and memory
   for (FunctionInfo const &func : state.table.functions) {
+    if (!state.IsExported(func)) {
+      continue;
+    }
     out.Child("export", Quote(func.name))
         .Child("func", Variable(func.name))
         .Inline();
   }
+  // hosts allocate strings they pass in, and release the ones returned to them
+  out.Child("export", Quote("alloc_string"))
+      .Child("func", Variable("_str_alloc"))
+      .Inline();
+  out.Child("export", Quote("release_string"))
+      .Child("func", Variable("_str_release"))
+      .Inline();
+  // let the host manage the heap as an arena
+  for (std::string name : {"heap_mark", "heap_reset", "heap_used"}) {
+    out.Child("export", Quote(name))
+        .Child("func", Variable("_" + name))
+        .Inline();
+  }
 
   return out;
 }
@@ -232,8 +1171,11 @@ ASTNode::EmitLiteral([[maybe_unused]] State &symbols) const {
 
 std::vector<WATExpr> ASTNode::EmitScope(State &state) const {
   std::vector<WATExpr> new_scope{};
-  for (ASTNode const &child : children) {
-    std::vector<WATExpr> child_exprs = child.Emit(state);
+  for (size_t i = 0; i < children.size(); i++) {
+    ASTNode const &child = children[i];
+    std::vector<WATExpr> child_exprs =
+        child.type == WHILE ? child.EmitWhile(state, CounterStart(i, state))
+                            : child.Emit(state);
     std::ranges::move(child_exprs, std::back_inserter(new_scope));
   }
   return new_scope;
@@ -243,16 +1185,18 @@ std::vector<WATExpr> ASTNode::EmitAssign(State &state, bool chain) const {
   assert(children.size() == 2);
   assert(children[0].type == IDENTIFIER || children[0].type == STRING_INDEX);
 
-  // this should produce some code which, when run, leaves the
-  // rvalue on the stack
-  std::vector<WATExpr> rvalue;
-
-  if (children.at(1).type == ASSIGN) {
-    rvalue = children.at(1).EmitAssign(state, true);
-  } else {
-    rvalue = children.at(1).Emit(state);
+  // s = s + ... appends to s, in place when it's the only reference
+  if (std::optional<std::vector<WATExpr>> append = EmitAppend(state)) {
+    if (chain) {
+      append->push_back(
+          WATExpr{"local.get", Variable("var", children.at(0).var_id)});
+    }
+    return append.value();
   }
 
+  // this should produce some code which, when run, leaves the
+  // rvalue on the stack
+  std::vector<WATExpr> rvalue = children.at(1).EmitOwned(state);
 
   if (children.at(0).type == IDENTIFIER) {
     VarType left_type = children.at(0).ReturnType(state.table);
@@ -261,6 +1205,18 @@ std::vector<WATExpr> ASTNode::EmitAssign(State &state, bool chain) const {
       rvalue.emplace_back("f64.convert_i32_s");
     }
     std::string op = chain ? "local.tee" : "local.set";
+    if (left_type.IsRefCounted()) {
+      if (right_type == VarType::CHAR) {
+        rvalue.emplace_back("call", Variable("charTo_str"));
+      }
+      // release the old value only once the new one has been computed,
+      // since it may be built from the old one
+      rvalue.push_back(
+          WATExpr{"call", Variable("_str_release"),
+                  WATExpr{"local.get", Variable("var", children[0].var_id)}});
+      rvalue.emplace_back(op, Variable("var", children[0].var_id));
+      return rvalue;
+    }
     return WATExpr{op, Variable("var", children[0].var_id), std::move(rvalue)};
   } else if (children.at(0).type == STRING_INDEX) {
     // this should be caught at parse-time
@@ -277,11 +1233,33 @@ std::vector<WATExpr> ASTNode::EmitAssign(State &state, bool chain) const {
     }
 
     std::string op = chain ? "assign_index_chain" : "assign_index";
-    return WATExpr("call")
-        .Push(Variable(op))
-        .Push(str_index.children.at(0).Emit(state))
-        .Push(str_index.children.at(1).Emit(state))
-        .Push(std::move(rvalue));
+    if (state.options.checked_indexing && !str_index.IsInBounds(state)) {
+      op += "_checked";
+    }
+    // static strings (literals and single-character strings) are shared by
+    // every use of them, so one is copied before it's written to. A variable
+    // keeps the copy; any other string is a temporary released afterwards
+    ASTNode const &target = str_index.children.at(0);
+    std::vector<WATExpr> cleanup{};
+    std::string str = Variable("var", target.var_id);
+    std::vector<WATExpr> unique = WATExpr{"local.get", str};
+    if (target.type != IDENTIFIER) {
+      str = Variable("var", state.AddTemp("_string", VarType::STRING));
+      cleanup.push_back(WATExpr{"call", Variable("_str_release"),
+                                WATExpr{"local.get", str}});
+      unique = target.EmitOwned(state);
+    }
+    std::vector<WATExpr> out =
+        WATExpr("call")
+            .Push(Variable(op))
+            .Push(WATExpr{"local.tee", str,
+                          WATExpr("call")
+                              .Push(Variable("_str_unique"))
+                              .Push(std::move(unique))})
+            .Push(str_index.children.at(1).Emit(state))
+            .Push(std::move(rvalue));
+    std::ranges::move(cleanup, std::back_inserter(out));
+    return out;
   }
   assert(false);
   
@@ -294,26 +1272,282 @@ ASTNode::EmitIdentifier([[maybe_unused]] State &state) const {
 
 std::vector<WATExpr> ASTNode::EmitConditional(State &state) const {
   assert(children.size() == 2 || children.size() == 3);
+  if (std::optional<std::vector<WATExpr>> table = EmitJumpTable(state)) {
+    return *table;
+  }
+  if (std::optional<std::vector<WATExpr>> select = EmitSelect(state)) {
+    return *select;
+  }
   std::vector<WATExpr> condition = children[0].Emit(state);
   WATExpr if_then_else{"if"};
 
   VarType rettype = ReturnType(state.table);
   if (rettype != VarType::NONE) {
-    if_then_else.Child("result", rettype.WATType()).Inline();
+    if_then_else.Child("result", rettype.WATType()).Inline();
+  }
+
+  if_then_else.Child("then", children[1].Emit(state));
+
+  if (children.size() == 3) {
+    if_then_else.Child("else", children[2].Emit(state));
+  }
+  condition.push_back(if_then_else);
+  return condition;
+}
+
+// arms bigger than this are left to a branch, since both would always run
+static constexpr size_t SELECT_MAX_SIZE = 8;
+
+std::optional<std::vector<WATExpr>>
+ASTNode::EmitSelect(State &state) const {
+  // a conditional that only picks between two small values, to return or to
+  // assign to one variable, computes both and keeps one with select, so a
+  // condition that's hard to predict doesn't cost a mispredicted branch
+  auto arm = [](size_t index, ASTNode const &node) -> ASTNode const * {
+    if (index >= node.children.size()) {
+      return nullptr;
+    }
+    ASTNode const *branch = &node.children.at(index);
+    while (branch->type == SCOPE && branch->children.size() == 1) {
+      branch = &branch->children.at(0);
+    }
+    bool empty = branch->type == EMPTY ||
+                 (branch->type == SCOPE && branch->children.empty());
+    return empty ? nullptr : branch;
+  };
+  auto value_of = [&state](ASTNode const *branch) -> ASTNode const * {
+    ASTNode const &value = branch->children.at(branch->type == ASSIGN);
+    return value.Size() <= SELECT_MAX_SIZE && value.IsBranchFree(state)
+               ? &value
+               : nullptr;
+  };
+
+  ASTNode const &condition = children.at(0);
+  ASTNode const *then_arm = arm(1, *this);
+  ASTNode const *else_arm = arm(2, *this);
+  // the arms are now computed before the condition, so it mustn't change
+  // what they read
+  if ((!then_arm && !else_arm) || condition.Contains(ASSIGN)) {
+    return std::nullopt;
+  }
+
+  std::vector<WATExpr> out{};
+  if (then_arm && else_arm && then_arm->type == RETURN &&
+      else_arm->type == RETURN) {
+    ASTNode const *then_value = value_of(then_arm);
+    ASTNode const *else_value = value_of(else_arm);
+    if (!then_value || !else_value) {
+      return std::nullopt;
+    }
+    WATExpr select{"select"};
+    select.Push(then_value->Emit(state));
+    select.Push(else_value->Emit(state));
+    select.Push(condition.Emit(state));
+    out.push_back(select);
+    std::ranges::move(EmitReleaseLocals(state), std::back_inserter(out));
+    if (state.inline_exit) {
+      out.emplace_back("br", state.inline_exit.value());
+    } else {
+      out.emplace_back("return");
+    }
+    return out;
+  }
+
+  // an arm that's missing leaves the variable as it was
+  ASTNode const *target = nullptr;
+  for (ASTNode const *branch : {then_arm, else_arm}) {
+    if (branch && (branch->type != ASSIGN ||
+                   branch->children.at(0).type != IDENTIFIER ||
+                   !value_of(branch) ||
+                   (target && target->var_id != branch->children.at(0).var_id))) {
+      return std::nullopt;
+    }
+    if (branch) {
+      target = &branch->children.at(0);
+    }
+  }
+  VarType target_type = target->ReturnType(state.table);
+  if (target_type != VarType::INT && target_type != VarType::CHAR &&
+      target_type != VarType::DOUBLE) {
+    return std::nullopt;
+  }
+
+  WATExpr select{"select"};
+  for (ASTNode const *branch : {then_arm, else_arm}) {
+    if (!branch) {
+      select.Push(target->Emit(state));
+      continue;
+    }
+    ASTNode const &value = branch->children.at(1);
+    select.Push(value.Emit(state));
+    if (target_type == VarType::DOUBLE &&
+        value.ReturnType(state.table) == VarType::INT) {
+      select.Child("f64.convert_i32_s");
+    }
+  }
+  select.Push(condition.Emit(state));
+  return std::vector<WATExpr>{
+      WATExpr{"local.set", Variable("var", target->var_id), std::move(select)}};
+}
+
+// ladders shorter than this test each arm in turn, and the table may have at
+// most this many slots, nor more than this many per arm
+static constexpr size_t JUMP_TABLE_MIN_ARMS = 4;
+static constexpr int64_t JUMP_TABLE_MAX_SPAN = 1024;
+static constexpr size_t JUMP_TABLE_MAX_SPARSITY = 3;
+
+std::optional<std::vector<WATExpr>>
+ASTNode::EmitJumpTable(State &state) const {
+  // an if/else-if ladder comparing one int or char variable against constants
+  // jumps straight to its arm through a br_table instead of testing each one
+  auto case_of = [&state](ASTNode const &condition)
+      -> std::optional<std::pair<size_t, int32_t>> {
+    if (condition.type != OPERATION || condition.literal != "==" ||
+        state.hoisted.contains(&condition)) {
+      return std::nullopt;
+    }
+    ASTNode const &lhs = condition.children.at(0);
+    ASTNode const &rhs = condition.children.at(1);
+    for (auto [var, constant] : {std::pair{&lhs, &rhs}, std::pair{&rhs, &lhs}}) {
+      VarType var_type = var->ReturnType(state.table);
+      if (var->type == IDENTIFIER && constant->type == LITERAL &&
+          (var_type == VarType::INT || var_type == VarType::CHAR) &&
+          constant->value->getType() == var_type) {
+        return std::pair{var->var_id,
+                         std::get<int>(constant->value->getValue())};
+      }
+    }
+    return std::nullopt;
+  };
+
+  ASTNode const *subject = nullptr;
+  std::vector<std::pair<int32_t, ASTNode const *>> arms{};
+  ASTNode const *fallback = nullptr;
+  for (ASTNode const *node = this;;) {
+    std::optional<std::pair<size_t, int32_t>> arm =
+        node->type == CONDITIONAL ? case_of(node->children.at(0))
+                                  : std::nullopt;
+    if (!arm || (subject && subject->var_id != arm->first)) {
+      fallback = node;
+      break;
+    }
+    if (!subject) {
+      ASTNode const &condition = node->children.at(0);
+      subject = condition.children.at(0).type == IDENTIFIER
+                    ? &condition.children.at(0)
+                    : &condition.children.at(1);
+    }
+    // a repeated constant can never reach its later arm
+    if (std::ranges::none_of(arms, [&arm](auto const &prior) {
+          return prior.first == arm->second;
+        })) {
+      arms.emplace_back(arm->second, &node->children.at(1));
+    }
+    if (node->children.size() < 3) {
+      break;
+    }
+    node = &node->children.at(2);
+  }
+
+  if (arms.size() < JUMP_TABLE_MIN_ARMS) {
+    return std::nullopt;
+  }
+  auto [low, high] = std::ranges::minmax(
+      arms | std::views::transform([](auto const &arm) { return arm.first; }));
+  int64_t const span = int64_t{high} - low + 1;
+  if (span > JUMP_TABLE_MAX_SPAN ||
+      span > static_cast<int64_t>(JUMP_TABLE_MAX_SPARSITY * arms.size())) {
+    return std::nullopt;
+  }
+
+  size_t const id = state.jump_table_count++;
+  std::string const exit = Variable("switch_", id);
+  std::string const otherwise = Variable("switch_", id, "_default");
+  std::vector<std::string> labels{};
+  for (size_t i = 0; i < arms.size(); i++) {
+    labels.push_back(Variable("switch_", id, "_", i));
+  }
+
+  WATExpr dispatch{"br_table"};
+  for (int64_t value = low; value <= high; value++) {
+    auto arm = std::ranges::find(arms, static_cast<int32_t>(value),
+                                 &std::pair<int32_t, ASTNode const *>::first);
+    dispatch.Push(arm == arms.end() ? otherwise
+                                    : labels.at(arm - arms.begin()));
+  }
+  dispatch.Push(otherwise);
+  std::vector<WATExpr> index = subject->Emit(state);
+  if (low != 0) {
+    WATExpr offset{"i32.sub"};
+    offset.Push(std::move(index)).PushChild("i32.const", std::to_string(low));
+    index = {offset};
+  }
+  dispatch.Push(std::move(index));
+
+  // each arm's block ends where its body starts, innermost arm first
+  WATExpr nested{"block", labels.at(0), std::move(dispatch)};
+  for (size_t i = 0; i < arms.size(); i++) {
+    WATExpr outer{"block",
+                  i + 1 < arms.size() ? labels.at(i + 1) : otherwise};
+    outer.Push(std::move(nested));
+    outer.Push(arms.at(i).second->Emit(state));
+    outer.PushChild("br", exit);
+    nested = std::move(outer);
+  }
+
+  WATExpr block{"block", exit};
+  VarType rettype = ReturnType(state.table);
+  if (rettype != VarType::NONE) {
+    block.Child("result", rettype.WATType()).Inline();
   }
-
-  if_then_else.Child("then", children[1].Emit(state));
-
-  if (children.size() == 3) {
-    if_then_else.Child("else", children[2].Emit(state));
+  block.Push(std::move(nested));
+  if (fallback) {
+    block.Push(fallback->Emit(state));
   }
-  condition.push_back(if_then_else);
-  return condition;
+  return std::vector<WATExpr>{block};
 }
 
 std::vector<WATExpr> ASTNode::EmitOperation(State &state) const {
   assert(children.size() >= 1);
-  std::vector<WATExpr> left = children.at(0).Emit(state);
+  if (std::ranges::any_of(children, [&state](ASTNode const &child) {
+        return child.ReturnType(state.table) == VarType::BUILDER;
+      })) {
+    ErrorNoLine("Invalid: builders can only be used with append(), "
+                "reserve(), finish() and size()");
+  }
+
+  if (literal == "**") {
+    return EmitPower(state);
+  }
+
+  // chains of concatenations (or any involving a char) are built in one go
+  if (literal == "+" && children.size() == 2 &&
+      ReturnType(state.table) == VarType::STRING) {
+    std::vector<ASTNode const *> pieces{};
+    CollectConcat(state, pieces);
+    bool has_char = std::ranges::any_of(pieces, [&state](ASTNode const *piece) {
+      return piece->ReturnType(state.table) != VarType::STRING;
+    });
+    if (pieces.size() > 2 || has_char) {
+      return EmitConcat(state, pieces);
+    }
+  }
+
+  if (auto out = EmitCompareInPlace(state)) {
+    return std::move(out.value());
+  }
+  if (auto out = EmitStrengthReduced(state)) {
+    return std::move(out.value());
+  }
+
+  // string operands are only borrowed, temporaries are released afterwards
+  std::vector<WATExpr> cleanup{};
+  auto finish = [&cleanup](std::vector<WATExpr> out) {
+    std::ranges::move(cleanup, std::back_inserter(out));
+    return out;
+  };
+
+  std::vector<WATExpr> left = children.at(0).EmitBorrowed(state, cleanup);
   VarType left_type = children.at(0).ReturnType(state.table);
 
   if (literal == "!") {
@@ -331,7 +1565,7 @@ std::vector<WATExpr> ASTNode::EmitOperation(State &state) const {
 
   // remaining operations are binary operations
   assert(children.size() == 2);
-  std::vector<WATExpr> right = children.at(1).Emit(state);
+  std::vector<WATExpr> right = children.at(1).EmitBorrowed(state, cleanup);
   VarType right_type = children.at(1).ReturnType(state.table);
   VarType op_type = std::max(left_type, right_type);
 
@@ -361,12 +1595,12 @@ std::vector<WATExpr> ASTNode::EmitOperation(State &state) const {
       out.Push(std::move(left));
       out.Push(std::move(right));
 
-      return out;
+      return finish(out);
     } else if (literal == "==") {
       WATExpr out{"call", Variable("str_eq")};
       out.Push(std::move(left));
       out.Push(std::move(right));
-      return out;
+      return finish(out);
     } else if (literal == "!=") {
       WATExpr eq{"call", Variable("str_eq")};
       eq.Push(std::move(left));
@@ -374,38 +1608,17 @@ std::vector<WATExpr> ASTNode::EmitOperation(State &state) const {
       WATExpr out{"i32.eq"};
       out.Child(std::move(eq));
       out.Child(WATExpr{"i32.const", "0"});
-      return out;
+      return finish(out);
     } else {
       ErrorNoLine("Unknown operation on two strings");
     }
   } else if (left_type == VarType::STRING || right_type == VarType::STRING) {
     if (left_type == VarType::INT && literal == "*") {
-      return EmitSpecialMult(std::move(right), std::move(left),
-                             VarType::STRING);
+      return finish(EmitSpecialMult(std::move(right), std::move(left),
+                                    VarType::STRING));
     } else if (right_type == VarType::INT && literal == "*") {
-      return EmitSpecialMult(std::move(left), std::move(right),
-                             VarType::STRING);
-    } else if (literal == "+") {
-
-      WATExpr chr{"call", Variable("charTo_str")};
-      WATExpr out{"call", Variable("addTwo_str")};
-      if (left_type == VarType::CHAR) {
-        chr.Push(std::move(left));
-        out.Push(chr);
-        // chr.Push(std::move(left));
-        out.Push(std::move(right));
-      } else if (right_type == VarType::CHAR) {
-        // chr.Push(std::move(right));
-        out.Push(std::move(left));
-        chr.Push(std::move(right)); // reordered -- it matters which argument to
-                                  // addTwo_str goes first, and presumably the
-                                  // left arg always goes before the right
-        out.Push(chr);
-      } else {
-        ErrorNoLine("Invalid action: Cannot perfom addition with a string and a "
-                    "non-string!");
-      }
-      return out;
+      return finish(EmitSpecialMult(std::move(left), std::move(right),
+                                    VarType::STRING));
     }
   } else if (left_type == VarType::CHAR && right_type == VarType::INT &&
              literal == "*") {
@@ -432,6 +1645,525 @@ std::vector<WATExpr> ASTNode::EmitOperation(State &state) const {
   return expr;
 }
 
+// powers up to this are multiplied out in place, bigger or negative ones
+// call the squaring loop in internal.wat
+static constexpr int POWER_MAX_UNROLLED = 256;
+
+// a shortest addition chain for n, as the two earlier elements each step adds
+// (the first element being 1), so that x ** n takes as few multiplications
+// as possible; only chains where each step adds to the one before are tried,
+// which are the shortest for every n we unroll
+static std::vector<std::pair<size_t, size_t>> PowerChain(int n) {
+  std::vector<int> chain{1};
+  std::vector<std::pair<size_t, size_t>> steps{};
+  std::function<bool(int)> search = [&](int depth) {
+    int const last = chain.back();
+    if (last == n) {
+      return true;
+    }
+    // even doubling every step can't reach n
+    if (depth == 0 || (int64_t{last} << depth) < n) {
+      return false;
+    }
+    for (size_t i = chain.size(); i-- > 0;) {
+      if (last + chain.at(i) > n) {
+        continue;
+      }
+      steps.emplace_back(chain.size() - 1, i);
+      chain.push_back(last + chain.at(i));
+      if (search(depth - 1)) {
+        return true;
+      }
+      chain.pop_back();
+      steps.pop_back();
+    }
+    return false;
+  };
+  for (int depth = 0; !search(depth); depth++) {
+  }
+  return steps;
+}
+
+std::vector<WATExpr> ASTNode::EmitPower(State &state) const {
+  assert(children.size() == 2);
+  ASTNode const &base = children.at(0);
+  ASTNode const &exponent = children.at(1);
+  VarType const power_type = ReturnType(state.table);
+  std::optional<int> constant = std::nullopt;
+  if (exponent.type == LITERAL && exponent.value->getType() == VarType::INT) {
+    constant = std::get<int>(exponent.value->getValue());
+  }
+
+  if (!constant || *constant < 0 || *constant > POWER_MAX_UNROLLED) {
+    WATExpr call{"call", Variable(power_type == VarType::DOUBLE ? "_pow_f64"
+                                                                : "_pow_i32")};
+    call.Push(base.Emit(state));
+    call.Push(exponent.Emit(state));
+    return call;
+  }
+  if (*constant == 1) {
+    return base.Emit(state);
+  }
+
+  std::vector<WATExpr> out{};
+  bool const simple = base.type == IDENTIFIER || base.type == LITERAL ||
+                      state.hoisted.contains(&base);
+  if (*constant == 0) {
+    if (!simple) {
+      out = base.Emit(state);
+      out.emplace_back("drop");
+    }
+    out.push_back(WATExpr{power_type.WATOperation("const"), "1"});
+    return out;
+  }
+
+  // each element of the chain but the last is kept in a temporary
+  std::vector<std::pair<size_t, size_t>> const steps = PowerChain(*constant);
+  std::vector<std::string> elements{};
+  auto element = [&](size_t index) -> std::vector<WATExpr> {
+    if (index == 0 && simple) {
+      return base.Emit(state);
+    }
+    return WATExpr{"local.get", elements.at(index)};
+  };
+  auto temp = [&state, power_type]() {
+    return Variable("var", state.AddTemp("_power", power_type));
+  };
+  elements.push_back(simple ? "" : temp());
+  if (!simple) {
+    out.push_back(WATExpr{"local.set", elements.at(0), base.Emit(state)});
+  }
+  for (size_t i = 0; i < steps.size(); i++) {
+    WATExpr product{power_type.WATOperation("mul")};
+    product.Push(element(steps.at(i).first));
+    product.Push(element(steps.at(i).second));
+    if (i + 1 == steps.size()) {
+      out.push_back(product);
+    } else {
+      elements.push_back(temp());
+      out.push_back(WATExpr{"local.set", elements.back(), std::move(product)});
+    }
+  }
+  return out;
+}
+
+std::optional<std::vector<WATExpr>>
+ASTNode::EmitStrengthReduced(State &state) const {
+  // arithmetic with a constant operand is done with cheaper instructions:
+  // shifts and masks for powers of two, a multiply for other divisors, and
+  // nothing at all for identities like x + 0 and x * 1
+  if (children.size() != 2 || children.at(0).type == ASSIGN ||
+      children.at(1).type == ASSIGN) {
+    return std::nullopt;
+  }
+  auto constant = [](ASTNode const &node, VarType of) -> std::optional<Value> {
+    if (node.type == LITERAL && node.value->getType() == of) {
+      return node.value;
+    }
+    return std::nullopt;
+  };
+  // an operand that's used twice is computed once, into a temporary
+  auto twice = [&state](ASTNode const &node) {
+    std::pair<std::vector<WATExpr>, std::vector<WATExpr>> uses{};
+    if (node.type == IDENTIFIER || node.type == LITERAL ||
+        state.hoisted.contains(&node)) {
+      uses.first = node.Emit(state);
+      uses.second = node.Emit(state);
+      return uses;
+    }
+    VarType node_type = node.ReturnType(state.table);
+    std::string const temp =
+        Variable("var", state.AddTemp("_operand", node_type));
+    uses.first = WATExpr{"local.tee", temp, node.Emit(state)};
+    uses.second = WATExpr{"local.get", temp};
+    return uses;
+  };
+  auto i32_const = [](auto value) {
+    return WATExpr{"i32.const", std::to_string(value)};
+  };
+
+  ASTNode const &lhs = children.at(0);
+  ASTNode const &rhs = children.at(1);
+  VarType result_type = ReturnType(state.table);
+  if (result_type == VarType::DOUBLE && literal == "*") {
+    // x * 2.0 is x + x
+    for (auto [x, c] : {std::pair{&lhs, &rhs}, std::pair{&rhs, &lhs}}) {
+      std::optional<Value> two = constant(*c, VarType::DOUBLE);
+      if (two && std::get<double>(two->getValue()) == 2.0 &&
+          x->ReturnType(state.table) == VarType::DOUBLE) {
+        auto [first, second] = twice(*x);
+        WATExpr sum{"f64.add"};
+        sum.Push(std::move(first)).Push(std::move(second));
+        return std::vector<WATExpr>{sum};
+      }
+    }
+    return std::nullopt;
+  }
+  if (result_type != VarType::INT ||
+      lhs.ReturnType(state.table) != VarType::INT ||
+      rhs.ReturnType(state.table) != VarType::INT) {
+    return std::nullopt;
+  }
+
+  auto int_constant = [&constant](ASTNode const &node) -> std::optional<int32_t> {
+    if (std::optional<Value> value = constant(node, VarType::INT)) {
+      return std::get<int>(value->getValue());
+    }
+    return std::nullopt;
+  };
+  std::optional<int32_t> left = int_constant(lhs);
+  std::optional<int32_t> right = int_constant(rhs);
+  if (left && right) {
+    return std::nullopt;
+  }
+
+  if ((literal == "+" && right == 0) || (literal == "-" && right == 0) ||
+      (literal == "*" && right == 1) || (literal == "/" && right == 1)) {
+    return lhs.Emit(state);
+  }
+  if ((literal == "+" && left == 0) || (literal == "*" && left == 1)) {
+    return rhs.Emit(state);
+  }
+
+  if (literal == "*") {
+    for (auto [x, c] : {std::pair{&lhs, right}, std::pair{&rhs, left}}) {
+      if (c && std::has_single_bit(static_cast<uint32_t>(*c))) {
+        WATExpr shift{"i32.shl"};
+        shift.Push(x->Emit(state));
+        shift.Push(i32_const(std::countr_zero(static_cast<uint32_t>(*c))));
+        return std::vector<WATExpr>{shift};
+      }
+    }
+    return std::nullopt;
+  }
+  if (!right || *right <= 0) {
+    return std::nullopt;
+  }
+  uint32_t const divisor = static_cast<uint32_t>(*right);
+
+  if (literal == "%" && std::has_single_bit(divisor)) {
+    // % is unsigned, so it's just the low bits
+    WATExpr mask{"i32.and"};
+    mask.Push(lhs.Emit(state));
+    mask.Push(i32_const(divisor - 1));
+    return std::vector<WATExpr>{mask};
+  }
+  if (literal != "/") {
+    return std::nullopt;
+  }
+
+  auto [first, second] = twice(lhs);
+  if (std::has_single_bit(divisor)) {
+    // an arithmetic shift rounds down, so negative values are first moved up
+    // by divisor - 1 to round towards zero instead
+    int const bits = std::countr_zero(divisor);
+    WATExpr bias{"i32.shr_u"};
+    bias.Push(WATExpr{"i32.shr_s"}.Push(std::move(second)).Push(i32_const(31)));
+    bias.Push(i32_const(32 - bits));
+    WATExpr sum{"i32.add"};
+    sum.Push(std::move(first)).Push(std::move(bias));
+    return std::vector<WATExpr>{
+        WATExpr{"i32.shr_s", std::move(sum), i32_const(bits)}};
+  }
+
+  // x / d is x * m / 2^s for m = 2^s / d rounded up, with s chosen so the
+  // error never reaches the next integer; that rounds down, so negative
+  // values are then moved up by one to round towards zero
+  int const shift = 31 + std::bit_width(divisor - 1);
+  uint64_t const multiplier = (uint64_t{1} << shift) / divisor + 1;
+  WATExpr product{"i64.mul"};
+  product.Push(WATExpr{"i64.extend_i32_s"}.Push(std::move(first)));
+  product.PushChild("i64.const", std::to_string(multiplier));
+  WATExpr quotient{"i32.add"};
+  quotient.Push(WATExpr{
+      "i32.wrap_i64",
+      WATExpr{"i64.shr_s", std::move(product),
+              WATExpr{"i64.const", std::to_string(shift)}}});
+  quotient.Push(
+      WATExpr{"i32.shr_u"}.Push(std::move(second)).Push(i32_const(31)));
+  return std::vector<WATExpr>{quotient};
+}
+
+void ASTNode::CollectConcat(State const &state,
+                            std::vector<ASTNode const *> &pieces) const {
+  // + is associative on strings, so nested concatenations on either side
+  // flatten into one list of pieces
+  if (type == OPERATION && literal == "+" && children.size() == 2 &&
+      ReturnType(state.table) == VarType::STRING &&
+      !state.hoisted.contains(this)) {
+    children.at(0).CollectConcat(state, pieces);
+    children.at(1).CollectConcat(state, pieces);
+  } else {
+    pieces.push_back(this);
+  }
+}
+
+std::vector<WATExpr>
+ASTNode::EmitConcat(State &state, std::vector<ASTNode const *> const &pieces,
+                    std::optional<size_t> append_to) const {
+  // evaluate each piece once, in order, keeping anything that isn't a plain
+  // variable or literal in a temporary
+  std::vector<WATExpr> out{};
+  std::vector<WATExpr> cleanup{};
+  std::vector<std::vector<WATExpr>> values{};
+  for (ASTNode const *piece : pieces) {
+    VarType piece_type = piece->ReturnType(state.table);
+    if (piece_type != VarType::STRING && piece_type != VarType::CHAR) {
+      ErrorNoLine("Invalid action: Cannot perfom addition with a string and a "
+                  "non-string!");
+    }
+    if (piece->type == IDENTIFIER || piece->type == LITERAL ||
+        state.hoisted.contains(piece)) {
+      values.push_back(piece->Emit(state));
+      continue;
+    }
+    size_t temp = state.AddTemp(
+        piece_type == VarType::STRING ? "_string" : "_char", piece_type);
+    if (piece->type == ASSIGN) {
+      // borrowed from the assigned variable
+      out.push_back(WATExpr{"local.set", Variable("var", temp),
+                            piece->EmitAssign(state, true)});
+    } else {
+      out.push_back(WATExpr{"local.set", Variable("var", temp),
+                            piece->Emit(state)});
+      if (piece_type == VarType::STRING) {
+        cleanup.push_back(
+            WATExpr{"call", Variable("_str_release"),
+                    WATExpr{"local.get", Variable("var", temp)}});
+      }
+    }
+    values.push_back(WATExpr{"local.get", Variable("var", temp)});
+  }
+
+  // add up the lengths: characters count for one each
+  size_t char_count = std::ranges::count_if(pieces, [&state](ASTNode const *piece) {
+    return piece->ReturnType(state.table) == VarType::CHAR;
+  });
+  WATExpr length{"i32.const", std::to_string(char_count)};
+  for (size_t i = 0; i < pieces.size(); ++i) {
+    if (pieces[i]->ReturnType(state.table) == VarType::STRING) {
+      length = WATExpr{"i32.add", std::move(length),
+                       WATExpr{"call", Variable("getStringLength"),
+                               std::vector<WATExpr>(values[i])}};
+    }
+  }
+
+  // allocate the result once, then copy each piece after the previous one
+  size_t result{};
+  WATExpr position{"local.tee"};
+  if (append_to) {
+    // or grow the string we're appending to, and copy after its old end
+    size_t offset = state.AddTemp("_offset", VarType::INT);
+    WATExpr target{"local.get", Variable("var", append_to.value())};
+    out.push_back(WATExpr{"local.set", Variable("var", offset),
+                          WATExpr{"call", Variable("getStringLength"), target}});
+    out.push_back(WATExpr{"local.set", Variable("var", append_to.value()),
+                          WATExpr{"call", Variable("append_str"), target,
+                                  std::move(length)}});
+    position = WATExpr{"i32.add", target,
+                       WATExpr{"local.get", Variable("var", offset)}};
+  } else {
+    result = state.AddTemp("_concat", VarType::STRING);
+    position = WATExpr{
+        "local.tee", Variable("var", result),
+        WATExpr{"call", Variable("_str_alloc"), std::move(length)}};
+  }
+  for (size_t i = 0; i < pieces.size(); ++i) {
+    bool is_char = pieces[i]->ReturnType(state.table) == VarType::CHAR;
+    position = WATExpr{"call", Variable(is_char ? "copyChar" : "copyStr"),
+                       std::move(position), std::move(values[i])};
+  }
+  out.push_back(WATExpr{"drop", std::move(position)});
+  std::ranges::move(cleanup, std::back_inserter(out));
+  if (!append_to) {
+    out.push_back(WATExpr{"local.get", Variable("var", result)});
+  }
+  return out;
+}
+
+std::optional<std::vector<WATExpr>> ASTNode::EmitAppend(State &state) const {
+  ASTNode const &target = children.at(0);
+  ASTNode const &value = children.at(1);
+  if (target.type != IDENTIFIER ||
+      target.ReturnType(state.table) != VarType::STRING ||
+      value.type != OPERATION || value.literal != "+" ||
+      value.ReturnType(state.table) != VarType::STRING ||
+      state.hoisted.contains(&value)) {
+    return std::nullopt;
+  }
+
+  // the chain must start with the target itself
+  std::vector<ASTNode const *> pieces{};
+  value.CollectConcat(state, pieces);
+  if (pieces.front()->type != IDENTIFIER ||
+      pieces.front()->var_id != target.var_id) {
+    return std::nullopt;
+  }
+
+  // the target's characters may be rewritten while the remaining pieces are
+  // copied, so they can't read it directly (computed pieces are evaluated
+  // beforehand, which is fine) or assign to it
+  LoopEffects effects{};
+  value.CollectEffects(effects, state.table);
+  bool reads_target = std::ranges::any_of(
+      pieces | std::views::drop(1), [&target](ASTNode const *piece) {
+        return piece->type == IDENTIFIER && piece->var_id == target.var_id;
+      });
+  if (reads_target || effects.assigned.contains(target.var_id)) {
+    return std::nullopt;
+  }
+
+  return EmitConcat(
+      state,
+      std::vector<ASTNode const *>(std::next(pieces.begin()), pieces.end()),
+      target.var_id);
+}
+
+std::optional<std::vector<WATExpr>>
+ASTNode::EmitCompareInPlace(State &state) const {
+  // a concatenation or substr() that's only compared never escapes the
+  // comparison, so its pieces are compared where they are instead of being
+  // copied into a new string first
+  auto in_place = [&state](ASTNode const &node) {
+    if (state.hoisted.contains(&node)) {
+      return false;
+    }
+    if (node.type == BUILT_IN_FUNCTION_CALL) {
+      return node.literal == "substr";
+    }
+    return node.type == OPERATION && node.literal == "+" &&
+           node.ReturnType(state.table) == VarType::STRING;
+  };
+  if ((literal != "==" && literal != "!=") || children.size() != 2 ||
+      children.at(0).ReturnType(state.table) != VarType::STRING ||
+      children.at(1).ReturnType(state.table) != VarType::STRING ||
+      !std::ranges::any_of(children, in_place)) {
+    return std::nullopt;
+  }
+
+  // evaluate everything once, in order, as in EmitConcat
+  std::vector<WATExpr> out{};
+  std::vector<WATExpr> cleanup{};
+  auto hold = [&](ASTNode const &node) -> std::vector<WATExpr> {
+    VarType node_type = node.ReturnType(state.table);
+    if (node.type == IDENTIFIER || node.type == LITERAL ||
+        state.hoisted.contains(&node)) {
+      return node.Emit(state);
+    }
+    size_t temp = state.AddTemp("_operand", node_type);
+    if (node.type == ASSIGN) {
+      out.push_back(WATExpr{"local.set", Variable("var", temp),
+                            node.EmitAssign(state, true)});
+    } else {
+      out.push_back(
+          WATExpr{"local.set", Variable("var", temp), node.Emit(state)});
+      if (node_type.IsRefCounted()) {
+        cleanup.push_back(
+            WATExpr{"call", Variable("_str_release"),
+                    WATExpr{"local.get", Variable("var", temp)}});
+      }
+    }
+    return WATExpr{"local.get", Variable("var", temp)};
+  };
+
+  // the side compared in place becomes a list of segments: a character, or
+  // a pointer and a length
+  struct Segment {
+    std::vector<WATExpr> value;
+    std::optional<std::vector<WATExpr>> length;
+  };
+  std::vector<Segment> segments{};
+  std::vector<WATExpr> other{};
+  for (ASTNode const &child : children) {
+    if (!in_place(child) || !segments.empty()) {
+      other = hold(child);
+      continue;
+    }
+    std::vector<ASTNode const *> pieces{};
+    child.CollectConcat(state, pieces);
+    for (ASTNode const *piece : pieces) {
+      if (piece->ReturnType(state.table) == VarType::CHAR) {
+        segments.push_back(Segment{hold(*piece), std::nullopt});
+      } else if (piece->type == BUILT_IN_FUNCTION_CALL &&
+                 piece->literal == "substr" &&
+                 !state.hoisted.contains(piece)) {
+        std::vector<WATExpr> str = hold(piece->children.at(0));
+        std::vector<WATExpr> start = hold(piece->children.at(1));
+        std::vector<WATExpr> length = hold(piece->children.at(2));
+        size_t temp = state.AddTemp("_slice", VarType::INT);
+        out.push_back(WATExpr{"local.set", Variable("var", temp),
+                              WATExpr("call", Variable("_slice"))
+                                  .Push(std::move(str))
+                                  .Push(std::move(start))
+                                  .Push(std::vector<WATExpr>(length))});
+        segments.push_back(
+            Segment{WATExpr{"local.get", Variable("var", temp)}, length});
+      } else if (piece->ReturnType(state.table) == VarType::STRING) {
+        std::vector<WATExpr> str = hold(*piece);
+        segments.push_back(Segment{
+            str, WATExpr{"call", Variable("getStringLength"),
+                         std::vector<WATExpr>(str)}});
+      } else {
+        ErrorNoLine("Invalid action: Cannot perfom addition with a string "
+                    "and a non-string!");
+      }
+    }
+  }
+
+  // equal lengths first, then each segment against its part of the other
+  // string, stopping at the first difference
+  // (offsets and the length are left out while they're still zero)
+  std::vector<WATExpr> length{};
+  std::vector<WATExpr> checks{};
+  for (Segment &segment : segments) {
+    std::vector<WATExpr> position = other;
+    if (!length.empty()) {
+      position = WATExpr("i32.add")
+                     .Push(std::move(position))
+                     .Push(std::vector<WATExpr>(length));
+    }
+    std::vector<WATExpr> size = WATExpr{"i32.const", "1"};
+    if (segment.length) {
+      size = std::move(segment.length.value());
+      checks.push_back(WATExpr("call", Variable("_mem_eq"))
+                           .Push(std::move(position))
+                           .Push(std::move(segment.value))
+                           .Push(std::vector<WATExpr>(size)));
+    } else {
+      checks.push_back(WATExpr("i32.eq")
+                           .Push(WATExpr("i32.load8_u").Push(std::move(position)))
+                           .Push(std::move(segment.value)));
+    }
+    if (length.empty()) {
+      length = std::move(size);
+    } else {
+      length = WATExpr("i32.add").Push(std::move(length)).Push(std::move(size));
+    }
+  }
+  std::vector<WATExpr> result{std::move(checks.back())};
+  checks.pop_back();
+  checks.insert(checks.begin(),
+                WATExpr("i32.eq")
+                    .Push(std::move(length))
+                    .PushChild("call", Variable("getStringLength"),
+                               std::move(other)));
+  while (!checks.empty()) {
+    WATExpr test = std::move(checks.back());
+    checks.pop_back();
+    result = {std::move(test),
+              WATExpr("if")
+                  .PushChild("result", "i32")
+                  .Push(WATExpr("then").Push(std::move(result)))
+                  .PushChild("else", WATExpr{"i32.const", "0"})};
+  }
+  if (literal == "!=") {
+    result.emplace_back("i32.eqz");
+  }
+  std::ranges::move(result, std::back_inserter(out));
+  std::ranges::move(cleanup, std::back_inserter(out));
+  return out;
+}
+
 std::vector<WATExpr> ASTNode::EmitSpecialMult(std::vector<WATExpr> content,
                                               std::vector<WATExpr> mul,
                                               VarType type) const {
@@ -448,8 +2180,47 @@ std::vector<WATExpr> ASTNode::EmitSpecialMult(std::vector<WATExpr> content,
   return out;
 }
 
-std::vector<WATExpr> ASTNode::EmitWhile(State &state) const {
+// loops are unrolled up to this many nodes in all, or this many times per
+// trip through the loop when the number of iterations isn't known
+static constexpr size_t UNROLL_MAX_SIZE = 160;
+static constexpr int64_t UNROLL_FACTOR = 4;
+
+std::vector<WATExpr>
+ASTNode::EmitWhile(State &state,
+                   std::optional<std::pair<int32_t, int32_t>> start) const {
   assert(children.size() == 2);
+  std::optional<LoopCounter> counter = FindCounter(state);
+  bool const unroll = counter && CanUnroll();
+  if (unroll && start && start->first == start->second) {
+    if (auto unrolled = EmitFullyUnrolled(state, *counter, start->first)) {
+      return std::move(unrolled.value());
+    }
+  }
+
+  // compute loop-invariant expressions once, before entering the loop.
+  // the condition always runs at least once, so expressions that may trap
+  // can only be hoisted from there
+  LoopEffects effects{};
+  CollectEffects(effects, state.table);
+  std::vector<ASTNode const *> invariants{};
+  children.at(0).FindInvariants(effects, state, true, invariants);
+  children.at(1).FindInvariants(effects, state, false, invariants);
+
+  std::vector<WATExpr> out{};
+  for (ASTNode const *expr : invariants) {
+    VarType expr_type = expr->ReturnType(state.table);
+    size_t temp = state.AddTemp("_invariant", expr_type);
+    std::vector<WATExpr> value = expr->EmitOwned(state);
+    if (expr_type.IsRefCounted()) {
+      // the temporary owns the string like any variable, so a return inside
+      // the loop releases it
+      state.table.variables.at(temp).is_temp = false;
+    }
+    value.emplace_back("local.set", Variable("var", temp));
+    value.back().Comment("Hoisted loop invariant", false);
+    std::ranges::move(value, std::back_inserter(out));
+    state.hoisted.emplace(expr, temp);
+  }
 
   state.loop_idx.push_back(0);
   state.loop_idx.back()++;
@@ -459,6 +2230,27 @@ std::vector<WATExpr> ASTNode::EmitWhile(State &state) const {
   std::string const loop_id = Variable("loop_", loop_label);
   std::string const loop_exit = Variable("loop_exit_", loop_label);
 
+  // a counter that starts at 0 or more and goes up by one while it's below
+  // size(s) is always a valid index into s inside the loop, since nothing
+  // else changes it and s stays the same string
+  std::optional<size_t> bounded_string = std::nullopt;
+  if (counter && counter->compare == "<" && counter->step == 1 && start &&
+      start->first >= 0) {
+    ASTNode const &bound = children.at(0).children.at(1);
+    if (bound.type == BUILT_IN_FUNCTION_CALL && bound.literal == "size" &&
+        bound.children.at(0).type == IDENTIFIER &&
+        bound.children.at(0).ReturnType(state.table) == VarType::STRING) {
+      bounded_string = bound.children.at(0).var_id;
+      state.in_bounds[counter->var_id] = bounded_string.value();
+    }
+  }
+
+  // most iterations run a few at a time, and the loop itself finishes off
+  // the rest
+  if (unroll && children.at(1).Size() * UNROLL_FACTOR <= UNROLL_MAX_SIZE) {
+    out.push_back(EmitUnrolledLoop(state, *counter, loop_label));
+  }
+
   // create loop block
   WATExpr block{"block", loop_exit};
   WATExpr &loop = block.Child("loop", loop_id);
@@ -475,7 +2267,93 @@ std::vector<WATExpr> ASTNode::EmitWhile(State &state) const {
       .Comment("Jump to start of while loop");
 
   state.loop_idx.pop_back();
+  out.push_back(std::move(block));
+  if (bounded_string) {
+    state.in_bounds.erase(counter->var_id);
+  }
+
+  // release hoisted strings once the loop is done, leaving zero behind so
+  // later returns don't release them again
+  for (ASTNode const *expr : invariants) {
+    size_t temp = state.hoisted.at(expr);
+    state.hoisted.erase(expr);
+    if (expr->ReturnType(state.table).IsRefCounted()) {
+      out.push_back(WATExpr{"call", Variable("_str_release"),
+                            WATExpr{"local.get", Variable("var", temp)}});
+      out.push_back(
+          WATExpr{"local.set", Variable("var", temp), WATExpr{"i32.const", "0"}});
+    }
+  }
+  return out;
+}
+
+std::optional<std::vector<WATExpr>>
+ASTNode::EmitFullyUnrolled(State &state, LoopCounter const &counter,
+                           int32_t start) const {
+  // with a constant bound the number of iterations is known, and a small
+  // enough loop is just its body that many times over
+  ASTNode const &bound = children.at(0).children.at(1);
+  if (bound.type != LITERAL) {
+    return std::nullopt;
+  }
+  int64_t const end = std::get<int>(bound.value->getValue());
+  int64_t const step = counter.step;
+  int64_t distance = step > 0 ? end - start : start - end;
+  if (counter.compare == "<=" || counter.compare == ">=") {
+    distance++;
+  }
+  int64_t const magnitude = step > 0 ? step : -step;
+  int64_t const trips =
+      distance <= 0 ? 0 : (distance + magnitude - 1) / magnitude;
+  // the counter must not wrap around on the way, or the loop wouldn't end
+  // where it seems to
+  int64_t const last = start + trips * step;
+  if (last < std::numeric_limits<int32_t>::min() ||
+      last > std::numeric_limits<int32_t>::max() ||
+      static_cast<size_t>(trips) * children.at(1).Size() > UNROLL_MAX_SIZE) {
+    return std::nullopt;
+  }
 
+  std::vector<WATExpr> out{};
+  for (int64_t i = 0; i < trips; i++) {
+    std::ranges::move(children.at(1).Emit(state), std::back_inserter(out));
+  }
+  return out;
+}
+
+WATExpr ASTNode::EmitUnrolledLoop(State &state, LoopCounter const &counter,
+                                  std::string const &label) const {
+  // runs the body UNROLL_FACTOR times per check, for as long as the counter
+  // will still be within the bound at the last of them. that's checked in 64
+  // bits, so looking ahead can't wrap around
+  std::string const loop_id = Variable("unroll_", label);
+  std::string const loop_exit = Variable("unroll_exit_", label);
+  std::map<std::string, std::string> const compare{
+      {"<", "i64.lt_s"}, {"<=", "i64.le_s"}, {">", "i64.gt_s"},
+      {">=", "i64.ge_s"}};
+
+  WATExpr ahead{"i64.add"};
+  ahead.PushChild("i64.extend_i32_s",
+                  WATExpr{"local.get", Variable("var", counter.var_id)});
+  ahead.PushChild("i64.const",
+                  std::to_string((UNROLL_FACTOR - 1) * counter.step));
+  WATExpr bound{"i64.extend_i32_s"};
+  bound.Push(children.at(0).children.at(1).Emit(state));
+  WATExpr check{compare.at(counter.compare)};
+  check.Push(std::move(ahead)).Push(std::move(bound));
+
+  WATExpr block{"block", loop_exit};
+  WATExpr &loop = block.Child("loop", loop_id);
+  loop.Child("br_if", loop_exit)
+      .Comment("Check there are " + std::to_string(UNROLL_FACTOR) +
+                   " iterations left",
+               false)
+      .Child("i32.eqz")
+      .Push(std::move(check));
+  for (int64_t i = 0; i < UNROLL_FACTOR; i++) {
+    loop.Push(children.at(1).Emit(state));
+  }
+  loop.Child("br", loop_id);
   return block;
 }
 
@@ -497,6 +2375,43 @@ std::vector<WATExpr> ASTNode::EmitFunction(State &state) const {
                 " does not have a return statement in all control flow paths");
   }
 
+  state.function_id = var_id;
+  state.outer_function_id = var_id;
+  state.self_tail_call = false;
+  state.inline_count = 0;
+  state.inlined_locals.clear();
+
+  // memoized functions return through a block, so the result can be saved
+  bool memoized = state.memo_tables.contains(var_id);
+  if (memoized) {
+    state.inline_exit = Variable("memo");
+  }
+
+  // emit the body first, since it may add compiler-generated locals
+  std::vector<WATExpr> body{};
+  int returnCount = 0;
+  for (size_t i = 0; i < children.size(); i++) {
+    ASTNode const &child = children[i];
+    if (returnCount > 0) {
+      ErrorNoLine("Function ", info.name,
+                  " shouldn't do anything after a return statement.");
+    }
+
+    std::ranges::move(child.type == WHILE
+                          ? child.EmitWhile(state, CounterStart(i, state))
+                          : child.Emit(state),
+                      std::back_inserter(body));
+
+    if (child.type == ASTNode::RETURN) {
+      returnCount += 1;
+    }
+  }
+
+  if (memoized) {
+    state.inline_exit = std::nullopt;
+    body = EmitMemoized(state, std::move(body));
+  }
+
   WATExpr function = WATExpr("func", Variable(info.name)).Newline();
 
   // write out parameters (first info.parameters values in info.variables)
@@ -509,34 +2424,101 @@ std::vector<WATExpr> ASTNode::EmitFunction(State &state) const {
   // add result to function
   function.Child("result", info.rettype.WATType()).Inline();
 
-  // write out locals (remaining values in info.variables)
+  // write out locals (remaining values in info.variables), then the locals
+  // of inlined calls
   for (size_t var_id : info.variables | std::views::drop(info.parameters)) {
     VariableInfo const &var = state.table.variables.at(var_id);
     function.Child("local", Variable("var", var_id), var.type_var.WATType())
         .Comment("Declare " + var.type_var.TypeName() + " " + var.name);
   }
+  for (size_t var_id : state.inlined_locals) {
+    VariableInfo const &var = state.table.variables.at(var_id);
+    function.Child("local", Variable("var", var_id), var.type_var.WATType())
+        .Comment("Declare inlined " + var.type_var.TypeName() + " " +
+                 var.name);
+  }
 
-  int returnCount = 0;
-  for (ASTNode const &child : children) {
-    if (returnCount > 0) {
-      ErrorNoLine("Function ", info.name,
-                  " shouldn't do anything after a return statement.");
-    }
+  if (state.self_tail_call) {
+    // the body always returns, so the loop never actually produces a value
+    function.Push(WATExpr("loop", "$tail_call")
+                      .PushChild("result", info.rettype.WATType())
+                      .Push(std::move(body)));
+  } else {
+    function.Push(std::move(body));
+  }
+
+  return function;
+}
 
-    function.Push(child.Emit(state));
+std::vector<WATExpr> ASTNode::EmitMemoized(State &state,
+                                           std::vector<WATExpr> body) const {
+  FunctionInfo const &info = state.table.functions.at(var_id);
+  std::vector<size_t> const params{info.variables.begin(),
+                                   info.variables.begin() + info.parameters};
+  size_t const stride = info.rettype == VarType::DOUBLE ? 16 : 8;
+  size_t const key = state.AddTemp("_memo_key", VarType::INT);
+  size_t const result = state.AddTemp("_memo_result", info.rettype);
+  auto get = [](size_t id) { return WATExpr{"local.get", Variable("var", id)}; };
+  auto entry = [&](size_t offset) {
+    return WATExpr{
+        "i32.add",
+        WATExpr{"i32.const",
+                std::to_string(state.memo_tables.at(var_id) + offset)},
+        WATExpr{"i32.mul", get(key), WATExpr{"i32.const",
+                                             std::to_string(stride)}}};
+  };
+  WATExpr in_table{"i32.lt_u", get(key),
+                   WATExpr{"i32.const", std::to_string(MEMO_ENTRIES)}};
 
-    if (child.type == ASTNode::RETURN) {
-      returnCount += 1;
-    }
+  // arguments outside the table get key -1, which is never in range
+  std::vector<WATExpr> out{};
+  if (params.size() == 1) {
+    out.push_back(WATExpr{"local.set", Variable("var", key), get(params[0])});
+  } else {
+    auto side = []() { return WATExpr{"i32.const", "64"}; };
+    out.push_back(WATExpr{
+        "local.set", Variable("var", key),
+        WATExpr{"select",
+                WATExpr{"i32.add", WATExpr{"i32.mul", get(params[0]), side()},
+                        get(params[1])},
+                WATExpr{"i32.const", "-1"},
+                WATExpr{"i32.and", WATExpr{"i32.lt_u", get(params[0]), side()},
+                        WATExpr{"i32.lt_u", get(params[1]), side()}}}});
   }
 
-  return function;
+  // return a result we've already computed
+  std::string const load = info.rettype.WATOperation("load");
+  out.push_back(in_table);
+  out.push_back(WATExpr("if").PushChild(
+      "then", WATExpr{"i32.load", entry(0)},
+      WATExpr("if").PushChild(
+          "then", WATExpr{"return", WATExpr{load, entry(stride / 2)}})));
+
+  // otherwise compute it, and save it on the way out
+  out.push_back(WATExpr("block", Variable("memo"))
+                    .PushChild("result", info.rettype.WATType())
+                    .Push(std::move(body)));
+  out.push_back(WATExpr{"local.set", Variable("var", result)});
+  out.push_back(in_table);
+  out.push_back(WATExpr("if").PushChild(
+      "then",
+      WATExpr{info.rettype.WATOperation("store"), entry(stride / 2),
+              get(result)},
+      WATExpr{"i32.store", entry(0), WATExpr{"i32.const", "1"}}));
+  out.push_back(get(result));
+  return out;
 }
 
 std::vector<WATExpr> ASTNode::EmitFunctionCall(State &state) const {
+  if (ShouldInline(state)) {
+    return EmitInline(state);
+  }
+  state.calls[state.outer_function_id].insert(var_id);
+
   std::vector<WATExpr> out{};
   for (ASTNode const &child : children) {
-    std::vector<WATExpr> child_exprs = child.Emit(state);
+    // the callee owns its parameters
+    std::vector<WATExpr> child_exprs = child.EmitOwned(state);
     for (auto expr : child_exprs) {
       out.push_back(expr);
     }
@@ -545,11 +2527,93 @@ std::vector<WATExpr> ASTNode::EmitFunctionCall(State &state) const {
   return out;
 }
 
+bool ASTNode::ShouldInline(State const &state) const {
+  ASTNode const &function = *state.function_nodes.at(var_id);
+  // the call costs little next to a loop, and loops nested in an expression
+  // compile to slower code than loops at the top of a function. A callee
+  // calling the function it was copied from, or another copy of it, is
+  // recursive too, even if it doesn't call itself
+  auto family = [&state](size_t id) {
+    return state.table.functions.at(id).specialization_of.value_or(id);
+  };
+  for (size_t id = 0; id < state.table.functions.size(); ++id) {
+    if (family(id) == family(var_id) && function.Calls(id)) {
+      return false;
+    }
+  }
+  if (function.Contains(WHILE)) {
+    return false;
+  }
+  // a function with only one caller costs nothing to copy there, unless the
+  // host needs to call it too
+  if (!state.IsExported(state.table.functions.at(var_id)) &&
+      state.call_sites.at(var_id) == 1) {
+    return true;
+  }
+  // otherwise only small functions are worth copying, more so in loops where
+  // the call would be made over and over
+  size_t const limit = state.loop_idx.empty() ? 12 : 40;
+  return function.Size() - 1 <= limit;
+}
+
+std::vector<WATExpr> ASTNode::EmitInline(State &state) const {
+  FunctionInfo &callee = state.table.functions.at(var_id);
+  ASTNode const &function = *state.function_nodes.at(var_id);
+
+  // the callee owns its parameters
+  std::vector<WATExpr> out{};
+  for (ASTNode const &child : children) {
+    std::ranges::move(child.EmitOwned(state), std::back_inserter(out));
+  }
+
+  // emit the callee's body in a block that its returns leave. Temporaries it
+  // needs join its locals for now, and all of them become our locals
+  size_t const caller_id = state.function_id;
+  std::optional<std::string> const caller_exit = state.inline_exit;
+  size_t const callee_locals = callee.variables.size();
+  std::string const exit = Variable("inline_", state.inline_count++);
+  state.function_id = var_id;
+  state.inline_exit = exit;
+  WATExpr block = WATExpr("block", exit).PushChild("result",
+                                                   callee.rettype.WATType());
+  for (ASTNode const &child : function.children) {
+    block.Push(child.Emit(state));
+  }
+  state.function_id = caller_id;
+  state.inline_exit = caller_exit;
+
+  // like a new call, locals start at zero, then the arguments (last one on
+  // top) become the parameters
+  for (size_t id : callee.variables | std::views::drop(callee.parameters)) {
+    VarType id_type = state.table.variables.at(id).type_var;
+    out.push_back(WATExpr{"local.set", Variable("var", id),
+                          WATExpr{id_type.WATOperation("const"), "0"}});
+  }
+  for (size_t id : callee.variables | std::views::take(callee.parameters) |
+                       std::views::reverse) {
+    out.emplace_back("local.set", Variable("var", id));
+  }
+  for (size_t id : callee.variables) {
+    if (std::ranges::find(state.inlined_locals, id) ==
+        state.inlined_locals.end()) {
+      state.inlined_locals.push_back(id);
+    }
+  }
+  callee.variables.resize(callee_locals);
+
+  out.push_back(std::move(block));
+  return out;
+}
+
 std::vector<WATExpr> ASTNode::EmitBuiltInFunctionCall(State &state) const {
   if (literal == "size") {
     assert(children.size() == 1);
-    return WATExpr("call", Variable("getStringLength"))
-        .Push(children[0].Emit(state));
+    std::vector<WATExpr> cleanup{};
+    std::vector<WATExpr> out =
+        WATExpr("call", Variable("getStringLength"))
+            .Push(children[0].EmitBorrowed(state, cleanup));
+    std::ranges::move(cleanup, std::back_inserter(out));
+    return out;
   } else if (literal == "sqrt") {
     assert(children.size() == 1);
     std::vector<WATExpr> left = children.at(0).Emit(state);
@@ -559,15 +2623,45 @@ std::vector<WATExpr> ASTNode::EmitBuiltInFunctionCall(State &state) const {
       sqrt.Child("f64.convert_i32_s");
     }
     return sqrt;
+  } else if (literal == "substr") {
+    assert(children.size() == 3);
+    std::vector<WATExpr> cleanup{};
+    std::vector<WATExpr> out =
+        WATExpr("call", Variable("substr"))
+            .Push(children[0].EmitBorrowed(state, cleanup))
+            .Push(children[1].Emit(state))
+            .Push(children[2].Emit(state));
+    std::ranges::move(cleanup, std::back_inserter(out));
+    return out;
+  } else if (literal == "append") {
+    // same as the in-place append for s = s + ...
+    std::vector<ASTNode const *> pieces{};
+    children.at(1).CollectConcat(state, pieces);
+    return EmitConcat(state, pieces, children.at(0).var_id);
+  } else if (literal == "reserve") {
+    std::string const builder = Variable("var", children.at(0).var_id);
+    return WATExpr{"local.set", builder,
+                   WATExpr{"call", Variable("reserve_str"),
+                           WATExpr{"local.get", builder},
+                           children.at(1).Emit(state)}};
+  } else if (literal == "finish") {
+    // hand over the builder's reference and start it over empty
+    std::string const builder = Variable("var", children.at(0).var_id);
+    std::vector<WATExpr> out{WATExpr{"local.get", builder}};
+    out.push_back(
+        WATExpr{"local.set", builder, children.at(1).Emit(state)});
+    return out;
   }
   assert(false);
 }
 
 std::vector<WATExpr> ASTNode::EmitStringIndex(State &state) const {
   assert(children.size() == 2);
-  WATExpr out{"call", Variable("index_str")};
+  bool const checked = state.options.checked_indexing && !IsInBounds(state);
+  WATExpr out{"call", Variable(checked ? "index_str_checked" : "index_str")};
 
-  std::vector<WATExpr> child_exprs = children.at(0).Emit(state);
+  std::vector<WATExpr> cleanup{};
+  std::vector<WATExpr> child_exprs = children.at(0).EmitBorrowed(state, cleanup);
   VarType child_type = children.at(0).ReturnType(state.table);
 
   std::vector<WATExpr> index = children.at(1).Emit(state);
@@ -579,5 +2673,7 @@ std::vector<WATExpr> ASTNode::EmitStringIndex(State &state) const {
 
   out.Push(std::move(child_exprs));
   out.Push(std::move(index));
-  return out;
+  std::vector<WATExpr> ret = out;
+  std::ranges::move(cleanup, std::back_inserter(ret));
+  return ret;
 }
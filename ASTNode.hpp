@@ -1,7 +1,9 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <optional>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -17,6 +19,23 @@ const std::unordered_map<std::string, std::string> LITERAL_TO_WAT = {
     {">=", "ge"},   {"==", "eq"}, {"!=", "ne"},
 };
 
+// side effects of a loop, used to decide which expressions are invariant
+struct LoopEffects {
+  // variables assigned anywhere in the loop
+  std::set<size_t> assigned{};
+  // whether the contents of any string may be written during the loop,
+  // either through an indexed assignment or by a function given a string
+  bool string_writes = false;
+};
+
+// a loop's counter: a variable compared against a bound that doesn't change
+// during the loop, and stepped by a constant at the end of every iteration
+struct LoopCounter {
+  size_t var_id{};
+  std::string compare{};
+  int32_t step{};
+};
+
 class ASTNode {
 public:
   enum Type {
@@ -98,29 +117,82 @@ public:
   }
 
   WATExpr EmitModule(State &state) const;
+  void SpecializeCalls(State &state);
 
   VarType ReturnType(SymbolTable const &table) const;
   bool HasReturn(State const &state) const;
 
+  void CollectEffects(LoopEffects &effects, SymbolTable const &table) const;
+  bool IsInvariant(LoopEffects const &effects, State const &state) const;
+  bool MayTrap(SymbolTable const &table) const;
+  bool IsBranchFree(State const &state) const;
+  size_t Size() const;
+  bool Contains(Type node_type) const;
+  bool Calls(size_t function_id, bool count_tail_calls = true) const;
+  bool IsPure(State const &state, size_t function_id) const;
+  bool CanMemoize(State const &state) const;
+  void CountCalls(State &state) const;
+  void FindInvariants(LoopEffects const &effects, State const &state,
+                      bool may_trap, std::vector<ASTNode const *> &out) const;
+  size_t CountAssigns(size_t id) const;
+  std::optional<LoopCounter> FindCounter(State const &state) const;
+  bool CanUnroll() const;
+  bool CollectConstantAssigns(size_t id, std::vector<int32_t> &values) const;
+  std::optional<std::pair<int32_t, int32_t>>
+  CounterStart(size_t index, State const &state) const;
+  bool IsInBounds(State const &state) const;
+
 private:
   std::vector<ASTNode> children{};
 
+  ASTNode Specialize(std::unordered_map<size_t, Value> const &constants,
+                     std::unordered_map<size_t, size_t> const &renamed) const;
+  static ASTNode Fold(ASTNode node);
+
   std::vector<WATExpr> Emit(State &state) const;
+  std::vector<WATExpr> EmitOwned(State &state) const;
+  std::vector<WATExpr> EmitBorrowed(State &state,
+                                    std::vector<WATExpr> &cleanup) const;
+  std::vector<WATExpr> EmitReleaseLocals(State &state) const;
+  std::vector<WATExpr> EmitReturn(State &state) const;
+  std::optional<std::vector<WATExpr>> EmitTailCall(State &state) const;
   std::vector<WATExpr> EmitLiteral(State &state) const;
   std::vector<WATExpr> EmitScope(State &state) const;
 
   std::vector<WATExpr> EmitAssign(State &state, bool chain = false) const;
   std::vector<WATExpr> EmitIdentifier(State &state) const;
   std::vector<WATExpr> EmitConditional(State &state) const;
+  std::optional<std::vector<WATExpr>> EmitJumpTable(State &state) const;
+  std::optional<std::vector<WATExpr>> EmitSelect(State &state) const;
   std::vector<WATExpr> EmitOperation(State &state) const;
+  void CollectConcat(State const &state,
+                     std::vector<ASTNode const *> &pieces) const;
+  std::vector<WATExpr>
+  EmitConcat(State &state, std::vector<ASTNode const *> const &pieces,
+             std::optional<size_t> append_to = std::nullopt) const;
+  std::optional<std::vector<WATExpr>> EmitAppend(State &state) const;
+  std::optional<std::vector<WATExpr>> EmitCompareInPlace(State &state) const;
+  std::optional<std::vector<WATExpr>> EmitStrengthReduced(State &state) const;
+  std::vector<WATExpr> EmitPower(State &state) const;
   std::vector<WATExpr> EmitSpecialMult(std::vector<WATExpr> content,
                                        std::vector<WATExpr> mul,
                                        VarType type) const;
-  std::vector<WATExpr> EmitWhile(State &state) const;
+  std::vector<WATExpr> EmitWhile(
+      State &state,
+      std::optional<std::pair<int32_t, int32_t>> start = std::nullopt) const;
+  std::optional<std::vector<WATExpr>>
+  EmitFullyUnrolled(State &state, LoopCounter const &counter,
+                    int32_t start) const;
+  WATExpr EmitUnrolledLoop(State &state, LoopCounter const &counter,
+                           std::string const &label) const;
   std::vector<WATExpr> EmitFunction(State &state) const;
+  std::vector<WATExpr> EmitMemoized(State &state,
+                                    std::vector<WATExpr> body) const;
   std::vector<WATExpr> EmitContinue(State &state) const;
   std::vector<WATExpr> EmitBreak(State &state) const;
   std::vector<WATExpr> EmitFunctionCall(State &state) const;
+  bool ShouldInline(State const &state) const;
+  std::vector<WATExpr> EmitInline(State &state) const;
   std::vector<WATExpr> EmitBuiltInFunctionCall(State &state) const;
   std::vector<WATExpr> EmitStringIndex(State &state) const;
 };
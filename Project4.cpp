@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <cassert>
 #include <fstream>
 #include <memory>
+#include <ranges>
 #include <regex>
 #include <string>
 #include <utility>
@@ -106,14 +108,22 @@ private:
     VarType const &var_type = ExpectToken(Lexer::ID_TYPE);
     Token const &ident = ExpectToken(Lexer::ID_ID);
     if (IfToken(Lexer::ID_ENDLINE)) {
-      state.table.AddVar(ident.lexeme, var_type, ident.line_id);
-      return ASTNode{};
+      size_t var_id = state.table.AddVar(ident.lexeme, var_type, ident.line_id);
+      if (var_type != VarType::BUILDER) {
+        return ASTNode{};
+      }
+      // builders start out empty, ready to append to
+      ASTNode out = ASTNode{ASTNode::ASSIGN};
+      out.AddChildren(ASTNode(ASTNode::IDENTIFIER, var_id),
+                      ASTNode{ASTNode::LITERAL, Value{state.AddString("")}});
+      return out;
     }
     ExpectToken(Lexer::ID_ASSIGN);
 
     ASTNode expr = ParseExpr();
     ExpectToken(Lexer::ID_ENDLINE);
     VarType right_type = expr.ReturnType(state.table);
+    CheckBuilderAssign(var_type, right_type);
     if (var_type < right_type) {
       Error(
           CurToken(),
@@ -130,6 +140,16 @@ private:
     return out;
   }
 
+  void CheckBuilderAssign(VarType left_type, VarType right_type) {
+    if (left_type == VarType::BUILDER && right_type != VarType::BUILDER &&
+        right_type != VarType::STRING) {
+      Error(CurToken(), "Only builder and string can be assigned to builder");
+    } else if (left_type != VarType::BUILDER &&
+               right_type == VarType::BUILDER) {
+      Error(CurToken(), "Use finish() to get the string out of a builder");
+    }
+  }
+
   ASTNode ParseExpr() { return ParseAssign(); }
 
   ASTNode ParseAssign() {
@@ -144,6 +164,7 @@ private:
       ASTNode rhs = ParseAssign();
       VarType left_type = lhs.ReturnType(state.table);
       VarType right_type = rhs.ReturnType(state.table);
+      CheckBuilderAssign(left_type, right_type);
       if (left_type == VarType::STRING && right_type != VarType::STRING &&
           right_type != VarType::CHAR) {
         Error(CurToken(), "Only string and char can be assigned to string");
@@ -221,12 +242,12 @@ private:
   }
 
   ASTNode ParseMulDivMod() {
-    auto lhs = std::make_unique<ASTNode>(ParseTerm());
+    auto lhs = std::make_unique<ASTNode>(ParsePower());
 
     while (CurToken().lexeme == "*" || CurToken().lexeme == "/" ||
            CurToken().lexeme == "%") {
       std::string operation = ConsumeToken().lexeme;
-      ASTNode rhs = ParseTerm();
+      ASTNode rhs = ParsePower();
 
       VarType lhs_type = lhs->ReturnType(state.table);
       VarType rhs_type = rhs.ReturnType(state.table);
@@ -259,6 +280,25 @@ private:
     return ASTNode{std::move(*lhs)};
   }
 
+  ASTNode ParsePower() {
+    ASTNode lhs = ParseTerm();
+    if (CurToken().lexeme != "**") {
+      return lhs;
+    }
+    Token const &curr_token = ConsumeToken();
+    // ** groups to the right, so 2 ** 3 ** 2 is 2 ** 9
+    ASTNode rhs = ParsePower();
+
+    VarType lhs_type = lhs.ReturnType(state.table);
+    if ((lhs_type != VarType::INT && lhs_type != VarType::DOUBLE) ||
+        rhs.ReturnType(state.table) != VarType::INT) {
+      Error(curr_token, "Invalid action: Can only raise an int or a double "
+                        "to an int power!");
+    }
+
+    return ASTNode(ASTNode::OPERATION, "**", std::move(lhs), std::move(rhs));
+  }
+
   bool isStringOrChar(ASTNode node) {
     // std::cout << "testing..." << std::endl;
     if (node.ReturnType(state.table) == VarType::CHAR ||
@@ -271,7 +311,8 @@ private:
   ASTNode ParseNegate() {
     auto lhs = std::make_unique<ASTNode>(ASTNode::LITERAL, Value{-1});
     Token const &curr_token = CurToken();
-    auto rhs = ParseTerm();
+    // -x ** 2 is -(x ** 2)
+    auto rhs = ParsePower();
 
     if (rhs.ReturnType(state.table) == VarType::CHAR) {
       Error(curr_token, "Invalid action: Cannot negate a char type!");
@@ -337,14 +378,37 @@ private:
       if (name == "size") {
         ASTNode out{ASTNode::BUILT_IN_FUNCTION_CALL, name};
         ASTNode arg = ParseExpr();
-        out.AddChild(std::move(arg));
-        if (arg.ReturnType(state.table) != VarType::STRING) {
+        VarType arg_type = arg.ReturnType(state.table);
+        if (arg_type != VarType::STRING && arg_type != VarType::BUILDER) {
           ErrorNoLine(
               "Invalid: Attempting to use size() on a non-string type.");
         }
+        out.AddChild(std::move(arg));
         ExpectToken(Lexer::ID_CLOSE_PARENTHESIS);
         return out;
       }
+      if (name == "substr") {
+        ASTNode out{ASTNode::BUILT_IN_FUNCTION_CALL, name};
+        ASTNode str = ParseExpr();
+        if (str.ReturnType(state.table) != VarType::STRING) {
+          ErrorNoLine(
+              "Invalid: Attempting to use substr() on a non-string type.");
+        }
+        out.AddChild(std::move(str));
+        for (int i = 0; i < 2; ++i) {
+          ExpectToken(',');
+          ASTNode arg = ParseExpr();
+          if (arg.ReturnType(state.table) != VarType::INT) {
+            ErrorNoLine("Invalid: substr() expects an int start and length.");
+          }
+          out.AddChild(std::move(arg));
+        }
+        ExpectToken(Lexer::ID_CLOSE_PARENTHESIS);
+        return out;
+      }
+      if (name == "append" || name == "reserve" || name == "finish") {
+        return ParseBuilderCall(name);
+      }
       size_t id = state.table.FindFunction(name, CurToken().line_id);
       ASTNode out{ASTNode::FUNCTION_CALL, id};
 
@@ -366,13 +430,110 @@ private:
     }
   }
 
+  ASTNode ParseBuilderCall(std::string const &name) {
+    // the builder is updated in place, so it has to be a variable
+    Token const &ident = ExpectToken(Lexer::ID_ID);
+    size_t var_id = state.table.FindVar(ident.lexeme, ident.line_id);
+    if (state.table.variables.at(var_id).type_var != VarType::BUILDER) {
+      Error(ident, "Invalid: Attempting to use ", name,
+            "() on a non-builder variable.");
+    }
+    ASTNode out{ASTNode::BUILT_IN_FUNCTION_CALL, name};
+    out.AddChild(ASTNode(ASTNode::IDENTIFIER, var_id));
+
+    if (name == "finish") {
+      // finishing hands over the contents and leaves the builder empty
+      out.AddChild(ASTNode{ASTNode::LITERAL, Value{state.AddString("")}});
+    } else {
+      ExpectToken(',');
+      ASTNode arg = ParseExpr();
+      VarType arg_type = arg.ReturnType(state.table);
+      if (name == "append" && arg_type != VarType::STRING &&
+          arg_type != VarType::CHAR) {
+        Error(CurToken(), "Invalid: Can only append a string or char.");
+      } else if (name == "reserve" && arg_type != VarType::INT) {
+        Error(CurToken(), "Invalid: reserve() expects an int capacity.");
+      }
+      out.AddChild(std::move(arg));
+    }
+    ExpectToken(Lexer::ID_CLOSE_PARENTHESIS);
+    return out;
+  }
+
   ASTNode ParseString() {
     Token const &token = ExpectToken(Lexer::ID_STRING);
-    size_t string_pos =
-        state.AddString(token.lexeme.substr(1, token.lexeme.size() - 2));
+    size_t string_pos = state.AddString(
+        DecodeString(token, token.lexeme.substr(1, token.lexeme.size() - 2)));
     return ASTNode{ASTNode::LITERAL, Value{string_pos}};
   }
 
+  // string literals use WAT's escapes (\n, \\, \41, \u{263a}, ...); decode
+  // them here so the literal's bytes (and its length) are the ones the
+  // program sees. The data segment escapes every byte again on the way out
+  std::string DecodeString(Token const &token, std::string const &text) {
+    auto hex_digit = [](char c) -> int {
+      if (c >= '0' && c <= '9') return c - '0';
+      if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+      if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+      return -1;
+    };
+    std::string out{};
+    for (size_t i = 0; i < text.size(); ++i) {
+      if (text[i] != '\\') {
+        out += text[i];
+        continue;
+      }
+      if (++i == text.size()) {
+        Error(token, "Unfinished escape sequence in string literal");
+      }
+      switch (text[i]) {
+      case 't': out += '\t'; continue;
+      case 'n': out += '\n'; continue;
+      case 'r': out += '\r'; continue;
+      case '\'': out += '\''; continue;
+      case '\\': out += '\\'; continue;
+      case 'u': {
+        size_t close = text.find('}', i);
+        uint32_t code = 0;
+        bool valid = i + 2 < close && close != std::string::npos &&
+                     text[i + 1] == '{';
+        for (size_t j = i + 2; valid && j < close; ++j) {
+          valid = hex_digit(text[j]) >= 0 && code <= 0x10ffff;
+          code = code * 16 + hex_digit(text[j]);
+        }
+        if (!valid || code > 0x10ffff || (code >= 0xd800 && code < 0xe000)) {
+          Error(token, "Invalid unicode escape in string literal");
+        }
+        // encode the code point as UTF-8
+        if (code < 0x80) {
+          out += static_cast<char>(code);
+        } else if (code < 0x800) {
+          out += static_cast<char>(0xc0 | (code >> 6));
+          out += static_cast<char>(0x80 | (code & 0x3f));
+        } else if (code < 0x10000) {
+          out += static_cast<char>(0xe0 | (code >> 12));
+          out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+          out += static_cast<char>(0x80 | (code & 0x3f));
+        } else {
+          out += static_cast<char>(0xf0 | (code >> 18));
+          out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+          out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+          out += static_cast<char>(0x80 | (code & 0x3f));
+        }
+        i = close;
+        continue;
+      }
+      }
+      if (i + 1 == text.size() || hex_digit(text[i]) < 0 ||
+          hex_digit(text[i + 1]) < 0) {
+        Error(token, "Invalid escape sequence in string literal");
+      }
+      out += static_cast<char>(hex_digit(text[i]) * 16 + hex_digit(text[i + 1]));
+      ++i;
+    }
+    return out;
+  }
+
   template <typename T> ASTNode ConstructLiteral(T value) {
     return CheckTypeCast(ASTNode(ASTNode::LITERAL, Value{value}));
   }
@@ -505,7 +666,11 @@ private:
     case Lexer::ID_RETURN: {
       ASTNode node = ASTNode{ASTNode::RETURN};
       ConsumeToken();
-      node.AddChild(ParseExpr());
+      ASTNode value = ParseExpr();
+      // returning is like assigning to the result of the current function
+      CheckBuilderAssign(state.table.functions.back().rettype,
+                         value.ReturnType(state.table));
+      node.AddChild(std::move(value));
       ExpectToken(Lexer::ID_ENDLINE);
       return node;
     }
@@ -522,7 +687,8 @@ private:
   }
 
 public:
-  Tubular(std::ifstream &input) {
+  Tubular(std::ifstream &input, CompilerOptions const &options) {
+    state.options = options;
     tokens = lexer.Tokenize(input);
     Parse();
   };
@@ -533,21 +699,68 @@ public:
     }
   }
 
-  WATExpr GenerateCode() { return root.EmitModule(state); }
+  WATExpr GenerateCode() {
+    root.SpecializeCalls(state);
+    return root.EmitModule(state);
+  }
 };
 
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    ErrorNoLine("Format: ", argv[0], " [filename]");
+  CompilerOptions options{};
+  std::string filename{};
+  auto page_count = [&](int &i) -> size_t {
+    if (i + 1 >= argc) {
+      ErrorNoLine("Expected a page count after ", argv[i]);
+    }
+    std::string count{argv[++i]};
+    if (count.empty() || count.size() > 5 ||
+        !std::ranges::all_of(count, ::isdigit) || std::stoul(count) > 65536) {
+      ErrorNoLine("Invalid page count '", count, "' (must be 0 to 65536)");
+    }
+    return std::stoul(count);
+  };
+  for (int i = 1; i < argc; i++) {
+    std::string arg{argv[i]};
+    if (arg == "--simd") {
+      options.simd = true;
+    } else if (arg == "--tail-calls") {
+      options.tail_calls = true;
+    } else if (arg == "--memoize") {
+      options.memoize = true;
+    } else if (arg == "--checked-indexing") {
+      options.checked_indexing = true;
+    } else if (arg == "--export") {
+      if (i + 1 >= argc) {
+        ErrorNoLine("Expected a comma-separated list of functions after ",
+                    argv[i]);
+      }
+      std::string names{argv[++i]};
+      for (auto name : std::views::split(names, ',')) {
+        options.exports.emplace_back(name.begin(), name.end());
+      }
+    } else if (arg == "--initial-pages") {
+      options.initial_pages = page_count(i);
+    } else if (arg == "--max-pages") {
+      options.max_pages = page_count(i);
+    } else if (arg.starts_with("--") || !filename.empty()) {
+      ErrorNoLine("Format: ", argv[0], " [options] [filename]");
+    } else {
+      filename = arg;
+    }
+  }
+  if (filename.empty()) {
+    ErrorNoLine("Format: ", argv[0], " [options] [filename]");
+  }
+  if (options.max_pages && options.max_pages.value() < options.initial_pages) {
+    ErrorNoLine("Maximum page count is less than the initial page count");
   }
 
-  std::string filename{argv[1]};
   std::ifstream in_file{filename};
   if (in_file.fail()) {
     ErrorNoLine("Unable to open file '", filename, "'.");
   }
 
-  Tubular tube{in_file};
+  Tubular tube{in_file, options};
   tube.Parse();
   WATExpr wat = tube.GenerateCode();
 
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <format>
 #include <iterator>
 #include <stdexcept>
@@ -98,8 +99,38 @@ bool SymbolTable::CheckTypes(size_t function_id, std::vector<VarType> arg_types,
 }
 
 size_t State::AddString(std::string const &literal) {
+  if (auto found = literal_pos.find(literal); found != literal_pos.end()) {
+    return found->second;
+  }
+  // same layout as internal.wat: reference count (always 0, since literals
+  // are never freed), length, characters, null terminator
+  size_t pos = AddStatic(8 + literal.size() + 1) + 8;
+  string_literals.emplace_back(pos, literal);
+  literal_pos.emplace(literal, pos);
+  return pos;
+}
+
+size_t State::AddStatic(size_t bytes) {
+  // reserve zeroed memory ahead of the heap, keeping 4-byte alignment
   size_t pos = string_pos;
-  string_pos += literal.size() + 1;
-  string_literals.push_back(literal);
+  string_pos = (pos + bytes + 3) & ~size_t{3};
   return pos;
 }
+
+size_t State::AddTemp(std::string const &name, VarType type) {
+  // compiler-generated locals are never looked up by name, so they skip the
+  // scope stack and go straight into the current function
+  size_t new_index = table.variables.size();
+  table.variables.push_back(VariableInfo{name, 0, type, false, true});
+  table.functions.at(function_id).variables.push_back(new_index);
+  return new_index;
+}
+
+bool State::IsExported(FunctionInfo const &func) const {
+  if (func.specialization_of) {
+    return false;
+  }
+  return options.exports.empty() ||
+         std::ranges::find(options.exports, func.name) !=
+             options.exports.end();
+}
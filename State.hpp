@@ -4,10 +4,13 @@
 #include <optional>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "Type.hpp"
 
+class ASTNode;
+
 using scope_t = std::unordered_map<std::string, size_t>;
 
 struct VariableInfo {
@@ -15,6 +18,8 @@ struct VariableInfo {
   size_t line_declared{};
   VarType type_var;
   bool is_assigned{};
+  // locals made up by the compiler, as opposed to declared in the program
+  bool is_temp{};
 };
 
 struct FunctionInfo {
@@ -25,6 +30,9 @@ struct FunctionInfo {
   // index of variables used in function
   std::vector<size_t> variables{};
   VarType rettype = VarType::UNKNOWN;
+  // for copies specialized for constant arguments, the function they were
+  // copied from. They are never exported
+  std::optional<size_t> specialization_of = std::nullopt;
 };
 
 class SymbolTable {
@@ -49,11 +57,74 @@ public:
                   size_t line_num) const;
 };
 
+// settings chosen on the command line
+struct CompilerOptions {
+  // use the SIMD128 versions of the string runtime functions
+  bool simd = false;
+  // size of linear memory in 64 KiB pages; the heap grows from the initial
+  // size as needed, up to the maximum if there is one
+  size_t initial_pages = 1;
+  std::optional<size_t> max_pages = std::nullopt;
+  // emit return_call for calls in tail position to other functions (calls
+  // to the function itself always become loops)
+  bool tail_calls = false;
+  // functions the host can call; all of them if empty. The rest only exist
+  // if some call to them wasn't inlined
+  std::vector<std::string> exports{};
+  // cache the results of pure recursive functions of one or two small ints
+  bool memoize = false;
+  // trap on string indexes outside the string, unless they're known to be
+  // inside it
+  bool checked_indexing = false;
+};
+
+struct StringLiteral {
+  // address of the first character; the header sits just before it
+  size_t pos;
+  std::string text;
+};
+
 struct State {
+  CompilerOptions options{};
   SymbolTable table{};
   std::vector<size_t> loop_idx{};
-  std::vector<std::string> string_literals{};
+  std::vector<StringLiteral> string_literals{};
+  // address of each distinct literal, so repeats share one copy
+  std::unordered_map<std::string, size_t> literal_pos{};
   size_t string_pos = 0;
+  // function currently being emitted (the inlined one, inside an inlined
+  // call), and the function whose code it ends up in
+  size_t function_id = 0;
+  size_t outer_function_id = 0;
+  // whether it calls itself in tail position, so its body is wrapped in a
+  // loop to jump back to
+  bool self_tail_call = false;
+  // expressions hoisted out of enclosing loops, mapped to the local holding
+  // their value
+  std::unordered_map<ASTNode const *, size_t> hoisted{};
+  // loop counters known to be valid indexes into a string throughout the
+  // loop, mapped to that string's variable
+  std::unordered_map<size_t, size_t> in_bounds{};
+
+  // definition of each function, and how many calls to it the program makes
+  std::unordered_map<size_t, ASTNode const *> function_nodes{};
+  std::unordered_map<size_t, size_t> call_sites{};
+  // functions without side effects, and the memo table of each memoized one
+  std::unordered_set<size_t> pure_functions{};
+  std::unordered_map<size_t, size_t> memo_tables{};
+  // functions each function still calls after inlining
+  std::unordered_map<size_t, std::unordered_set<size_t>> calls{};
+  // while emitting a call inline, the block its return statements leave
+  std::optional<std::string> inline_exit = std::nullopt;
+  size_t inline_count = 0;
+  // if/else-if ladders lowered to a br_table so far, naming their blocks
+  size_t jump_table_count = 0;
+  // locals of the functions inlined into the current one
+  std::vector<size_t> inlined_locals{};
+
+  bool IsExported(FunctionInfo const &func) const;
 
   size_t AddString(std::string const &literal);
+  size_t AddStatic(size_t bytes);
+  size_t AddTemp(std::string const &name, VarType type);
 };
@@ -28,6 +28,8 @@ VarType::TypeId VarType::TypeFromToken(const Token &token) {
     return VarType::DOUBLE;
   } else if (lexeme == "string") {
     return VarType::STRING;
+  } else if (lexeme == "builder") {
+    return VarType::BUILDER;
   } else {
     Error(token, "Unknown type ", lexeme);
   }
@@ -43,6 +45,8 @@ std::string VarType::TypeName() const {
     return "double";
   case VarType::STRING:
     return "string";
+  case VarType::BUILDER:
+    return "builder";
   default:
     throw std::invalid_argument("Attempt to access unknown type");
   }
@@ -53,6 +57,7 @@ std::string VarType::WATType() const {
   case VarType::INT:
   case VarType::CHAR:
   case VarType::STRING:
+  case VarType::BUILDER:
     return "i32";
   case VarType::DOUBLE:
     return "f64";
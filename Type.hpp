@@ -8,7 +8,7 @@ class Value;
 
 class VarType {
 public:
-  enum TypeId { UNKNOWN, NONE, CHAR, INT, DOUBLE, STRING };
+  enum TypeId { UNKNOWN, NONE, CHAR, INT, DOUBLE, STRING, BUILDER };
 
 private:
   static TypeId TypeFromValue(Value const &value);
@@ -26,4 +26,6 @@ public:
   std::string TypeName() const;
   std::string WATType() const;
   std::string WATOperation(std::string operation, bool is_signed = false) const;
+  // values that point at reference-counted heap blocks
+  bool IsRefCounted() const { return id == STRING || id == BUILDER; }
 };
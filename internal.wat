@@ -1,93 +1,407 @@
-;; Function to allocate space for a string; add one to size and place null terminator there.
+;; Strings are stored as a 32-bit length, followed by the characters, followed
+;; by a null terminator. A string value points at its first character, so the
+;; length lives at (ptr - 4). The word before that, at (ptr - 8), is the
+;; string's reference count; a count of 0 marks a string that is never freed
+;; (string literals).
+;;
+;; Heap strings also record their size class at (ptr - 12): the block holds
+;; 2^class bytes of characters (null terminator included). Freed blocks are
+;; kept on one free list per size class, linked through their first 4 bytes;
+;; the list heads live in the table at $_free_lists.
+
+;; Make sure linear memory extends at least up to address $end, growing it
+;; geometrically. Traps if memory can't grow far enough.
+(func $_heap_reserve (param $end i32)
+  (local $current i32)  ;; Pages we have now.
+  (local $needed i32)   ;; Pages we need to reach $end.
+  (memory.size)
+  (local.set $current)
+  (i32.add                  ;; Round $end up to a whole page.
+    (i32.shr_u
+      (i32.sub (local.get $end) (i32.const 1))
+      (i32.const 16))
+    (i32.const 1))
+  (local.set $needed)
+  (i32.le_u (local.get $needed) (local.get $current))
+  (if
+    (then (return)))
+
+  ;; Try to at least double memory so repeated allocations stay cheap...
+  (memory.grow
+    (select
+      (local.get $current)
+      (i32.sub (local.get $needed) (local.get $current))
+      (i32.gt_u
+        (local.get $current)
+        (i32.sub (local.get $needed) (local.get $current)))))
+  (i32.const -1)
+  (i32.ne)
+  (if
+    (then (return)))
+  ;; ...but doubling might pass the maximum, so fall back to what we need.
+  (memory.grow (i32.sub (local.get $needed) (local.get $current)))
+  (i32.const -1)
+  (i32.eq)
+  (if
+    (then (unreachable))))
+
+;; Size class for a string of the given length: the smallest power of two
+;; that holds the characters and null terminator, but at least 16 bytes.
+(func $_size_class (param $size i32) (result i32)
+  (local $class i32)
+  (i32.sub
+    (i32.const 32)
+    (i32.clz (local.get $size)))
+  (local.tee $class)
+  (i32.const 4)
+  (i32.lt_u)
+  (if (result i32)
+    (then (i32.const 4))
+    (else (local.get $class))))
+
+;; Function to allocate space for a string of the given length; writes the
+;; header and null terminator, and returns a pointer to the characters. The
+;; new string starts with a reference count of 1.
 (func $_str_alloc (param $size i32) (result i32)
-  (local $null_pos i32)     ;; Local variable for where to place null terminator.
-  (global.get $_free)       ;; Staring free pos is start of new string; put on stack to return.
-  (i32.add                  ;; Add free pos and size to get position for null terminator.
-    (global.get $_free)     ;; Load a second copy to adjust new free pos.
-    (local.get $size))      ;; Load size of new string
-  (local.set $null_pos)     ;; Save position for null terminator to use it again.
+  (local $str_ptr i32)      ;; Pointer to the characters of the new string.
+  (local $class i32)        ;; Size class for the new string.
+  (local $link i32)         ;; Address of the pointer to the current block.
+  ;; Negative sizes (and anything that would overflow the address space)
+  ;; can never be satisfied.
+  (i32.gt_u (local.get $size) (i32.const 0x7ffffff0))
+  (if
+    (then (unreachable)))
+
+  (local.set $class
+    (call $_size_class (local.get $size)))
+  (i32.add
+    (global.get $_free_lists)
+    (i32.shl (local.get $class) (i32.const 2)))
+  (local.set $link)
+
+  ;; Reuse the first freed block at or past the heap mark; blocks before it
+  ;; stay on the list and are skipped.
+  (block $list_done
+    (loop $list
+      (i32.load (local.get $link))
+      (local.tee $str_ptr)
+      (br_if $list_done (i32.eqz))
+      (br_if $list_done     ;; Compare where the block's header starts.
+        (i32.ge_u
+          (i32.sub (local.get $str_ptr) (i32.const 12))
+          (global.get $_mark)))
+      (local.set $link (local.get $str_ptr))
+      (br $list)))
+
+  (local.get $str_ptr)
+  (if
+    (then                   ;; Reuse the freed block, unlinking it from the list.
+      (i32.store
+        (local.get $link)
+        (i32.load (local.get $str_ptr))))
+    (else                   ;; Otherwise carve a new block off the free memory.
+      (i32.add
+        (global.get $_free)
+        (i32.const 12))
+      (local.set $str_ptr)
+      (call $_heap_reserve
+        (i32.add
+          (local.get $str_ptr)
+          (i32.shl (i32.const 1) (local.get $class))))
+      (i32.store
+        (global.get $_free)
+        (local.get $class))
+      (i32.add
+        (local.get $str_ptr)
+        (i32.shl (i32.const 1) (local.get $class)))
+      (global.set $_free))) ;; Update free memory start.
+
+  (i32.store                ;; Reference count.
+    (i32.sub (local.get $str_ptr) (i32.const 8))
+    (i32.const 1))
+  (i32.store                ;; Write length header.
+    (i32.sub (local.get $str_ptr) (i32.const 4))
+    (local.get $size))
   (i32.store8               ;; Place null terminator.
-    (local.get $null_pos)
+    (i32.add
+      (local.get $str_ptr)
+      (local.get $size))
     (i32.const 0))
+  (local.get $str_ptr))
+
+;; Add a reference to a string; returns the string so it can be used inline.
+(func $_str_retain (param $str_ptr i32) (result i32)
+  (local $count i32)
+  (local.get $str_ptr)
+  (if
+    (then
+      (i32.load (i32.sub (local.get $str_ptr) (i32.const 8)))
+      (local.tee $count)
+      (if                   ;; Static strings aren't counted.
+        (then
+          (i32.store
+            (i32.sub (local.get $str_ptr) (i32.const 8))
+            (i32.add (local.get $count) (i32.const 1)))))))
+  (local.get $str_ptr))
+
+;; Drop a reference to a string, putting its block on the free list for its
+;; size class once nothing refers to it. Releasing 0 (an uninitialized
+;; string variable) does nothing.
+(func $_str_release (param $str_ptr i32)
+  (local $count i32)
+  (local $list i32)
+  (i32.eqz (local.get $str_ptr))
+  (if
+    (then (return)))
+  (i32.load (i32.sub (local.get $str_ptr) (i32.const 8)))
+  (local.tee $count)
+  (i32.eqz)                 ;; Static strings are never freed.
+  (if
+    (then (return)))
+  (i32.sub (local.get $count) (i32.const 1))
+  (local.set $count)
+  (i32.store
+    (i32.sub (local.get $str_ptr) (i32.const 8))
+    (local.get $count))
+  (local.get $count)
+  (if
+    (then (return)))
+
   (i32.add
-    (i32.const 1)
-    (local.get $null_pos))  ;; Increment past null for new free pos.
-  (global.set $_free))      ;; Update free memory start.
+    (global.get $_free_lists)
+    (i32.shl
+      (i32.load (i32.sub (local.get $str_ptr) (i32.const 12)))
+      (i32.const 2)))
+  (local.set $list)
+  (i32.store                ;; Link the block in at the head of its list.
+    (local.get $str_ptr)
+    (i32.load (local.get $list)))
+  (i32.store
+    (local.get $list)
+    (local.get $str_ptr)))
+
+;; Return a string that indexed assignment can write to. Static strings are
+;; shared by every use of them, so they're copied first; the copy belongs to
+;; the caller in place of the static string.
+(func $_str_unique (param $str_ptr i32) (result i32)
+  (local $copy i32)
+  (i32.load (i32.sub (local.get $str_ptr) (i32.const 8)))
+  (if
+    (then (return (local.get $str_ptr))))
+  (call $_str_alloc (call $getStringLength (local.get $str_ptr)))
+  (local.tee $copy)
+  (local.get $str_ptr)
+  (call $getStringLength (local.get $str_ptr))
+  (memory.copy)
+  (local.get $copy))
+
+;; Heap checkpoints let a host treat each call as an arena: take a mark before
+;; the call, and reset to it afterwards to drop everything allocated since.
+;; From then on, freed blocks before the latest mark are never reused, since
+;; a reset couldn't free them again; that memory is lost for good.
+(func $_heap_mark (result i32)
+  (global.set $_mark (global.get $_free))
+  (global.get $_free))
+
+;; Free everything allocated after $mark was taken. Strings allocated since
+;; then must not be used afterwards. Marks outside the heap trap, so the
+;; string literals and free list table in front of it are never reset.
+(func $_heap_reset (param $mark i32)
+  (local $class i32)        ;; Size class whose free list is being pruned.
+  (local $link i32)         ;; Address of the pointer to the current block.
+  (local $block i32)        ;; Current block on the free list.
+  (i32.or
+    (i32.lt_u (local.get $mark) (global.get $_heap_base))
+    (i32.gt_u (local.get $mark) (global.get $_free)))
+  (if
+    (then (unreachable)))
+
+  ;; Freed blocks past the mark are about to be handed out again by the bump
+  ;; allocator, so unlink them from the free lists first.
+  (block $classes_done
+    (loop $classes
+      (br_if $classes_done
+        (i32.eq (local.get $class) (i32.const 32)))
+      (i32.add
+        (global.get $_free_lists)
+        (i32.shl (local.get $class) (i32.const 2)))
+      (local.set $link)
+      (block $list_done
+        (loop $list
+          (i32.load (local.get $link))
+          (local.tee $block)
+          (br_if $list_done (i32.eqz))
+          (i32.ge_u              ;; Compare where the block's header starts.
+            (i32.sub (local.get $block) (i32.const 12))
+            (local.get $mark))
+          (if
+            (then                ;; Unlink the block, keeping the same link.
+              (i32.store
+                (local.get $link)
+                (i32.load (local.get $block))))
+            (else                ;; Keep the block and move past it.
+              (local.set $link (local.get $block))))
+          (br $list)))
+      (local.set $class
+        (i32.add (local.get $class) (i32.const 1)))
+      (br $classes)))
+
+  (global.set $_mark (local.get $mark))
+  (global.set $_free (local.get $mark)))
+
+;; Bytes of heap handed out so far, including blocks sitting on free lists.
+(func $_heap_used (result i32)
+  (i32.sub
+    (global.get $_free)
+    (global.get $_heap_base)))
+
+;; Make room for $extra more characters at the end of $str, which the caller
+;; owns. When nothing else refers to $str, it grows in place if its block has
+;; room, or if its block is the last one on the heap and can simply be
+;; extended. Otherwise the characters move to a new string and $str is
+;; released. Returns the (possibly moved) string with its length updated;
+;; the new characters are left for the caller to write.
+(func $append_str (param $str i32) (param $extra i32) (result i32)
+  (local $length i32)       ;; Length after appending.
+  (local $class i32)        ;; Size class needed for the new length.
+  (local $res_val i32)      ;; Return value
+  (i32.add
+    (call $getStringLength (local.get $str))
+    (local.get $extra))
+  (local.tee $length)
+  (i32.const 0x7ffffff0)
+  (i32.gt_u)
+  (if
+    (then (unreachable)))
+
+  (i32.eq
+    (i32.load (i32.sub (local.get $str) (i32.const 8)))
+    (i32.const 1))
+  (if
+    (then
+      (local.set $class
+        (call $_size_class (local.get $length)))
+      (i32.gt_u
+        (local.get $class)
+        (i32.load (i32.sub (local.get $str) (i32.const 12))))
+      (if
+        (then
+          ;; Too big for the block; only the last block on the heap can grow,
+          ;; and not across the heap mark.
+          (i32.ne
+            (i32.add
+              (local.get $str)
+              (i32.shl
+                (i32.const 1)
+                (i32.load (i32.sub (local.get $str) (i32.const 12)))))
+            (global.get $_free))
+          (i32.lt_u
+            (i32.sub (local.get $str) (i32.const 12))
+            (global.get $_mark))
+          (i32.or)
+          (if
+            (then (br 2)))      ;; Fall back to copying.
+          (call $_heap_reserve
+            (i32.add
+              (local.get $str)
+              (i32.shl (i32.const 1) (local.get $class))))
+          (global.set $_free
+            (i32.add
+              (local.get $str)
+              (i32.shl (i32.const 1) (local.get $class))))
+          (i32.store
+            (i32.sub (local.get $str) (i32.const 12))
+            (local.get $class))))
+      (i32.store              ;; Write new length header.
+        (i32.sub (local.get $str) (i32.const 4))
+        (local.get $length))
+      (i32.store8             ;; Place null terminator.
+        (i32.add
+          (local.get $str)
+          (local.get $length))
+        (i32.const 0))
+      (return (local.get $str))))
+
+  (call $_str_alloc (local.get $length))
+  (local.tee $res_val)
+  (local.get $str)
+  (call $copyStr)
+  (drop)
+  (call $_str_release (local.get $str))
+  (local.get $res_val))
 
-(func $getStringLength (param $str_ptr i32) (result i32)
-    (local $length i32) ;; Variable to store the string length
-    ;; Initialize length to 0
-    (i32.const 0)
-    (local.set $length)
-
-    (block $exit1 ;; Outer block
-      (loop $loop
-        ;; Load a byte from the current address
-        (local.get $str_ptr)
-        (local.get $length)
-        (i32.add)          ;; Current address = start + length
-        (i32.load8_u)      ;; Load 1 byte from memory (unsigned)
-
-        ;; Check if it's the null terminator
-        (i32.eqz)          ;; Is the byte 0?
-        (br_if $exit1)
-
-        ;; Increment length
-        (local.get $length)
-        (i32.const 1)
-        (i32.add)
-        (local.set $length)
-
-        ;; Continue the loop
-        (br $loop)
-      )
-    )
-    ;; Return the calculated length
-    (local.get $length))
+;; Make sure $str, which the caller owns, has room for $capacity characters
+;; without moving again. Returns the (possibly moved) string.
+(func $reserve_str (param $str i32) (param $capacity i32) (result i32)
+  (local $length i32)
+  (local $res_val i32)      ;; Return value
+  (local.set $length
+    (call $getStringLength (local.get $str)))
+  (i32.lt_s (local.get $capacity) (local.get $length))
+  (if
+    (then (local.set $capacity (local.get $length))))
+
+  ;; Nothing to do for a big enough unshared block. (Static strings have no
+  ;; size class, so only check it for heap strings.)
+  (i32.eq
+    (i32.load (i32.sub (local.get $str) (i32.const 8)))
+    (i32.const 1))
+  (if
+    (then
+      (i32.le_u
+        (call $_size_class (local.get $capacity))
+        (i32.load (i32.sub (local.get $str) (i32.const 12))))
+      (if
+        (then (return (local.get $str))))))
 
-(func $copyStr (param $mem_ptr i32) (param $str i32) (result i32)
-  (local $index i32) 
+  (call $_str_alloc (local.get $capacity))
+  (local.tee $res_val)
+  (local.get $str)
+  (call $copyStr)
   (i32.const 0)
-  (local.set $index)
-
-  (block $exit1 ;; Outer block
-    (loop $loop
-      ;; Load a byte from the current address
-      (local.get $str)
-      (local.get $index)
-      (i32.add) 
-      (i32.load8_u)      ;; Load 1 byte from memory (unsigned)
-
-      ;; Check if it's the null terminator
-      (i32.eqz)          ;; Is the byte 0?
-      (br_if $exit1)
-  
-      (local.get $mem_ptr)
-
-      (local.get $str)
-      (local.get $index)
-      (i32.add)          ;; Current address = start + length
-      (i32.load8_u)
+  (i32.store8)              ;; Null terminator after the copied characters.
+  (i32.store                ;; Keep the old length.
+    (i32.sub (local.get $res_val) (i32.const 4))
+    (local.get $length))
+  (call $_str_release (local.get $str))
+  (local.get $res_val))
 
-      (i32.store8)
+(func $getStringLength (param $str_ptr i32) (result i32)
+  ;; Length is stored in the header just before the characters
+  (i32.load
+    (i32.sub
+      (local.get $str_ptr)
+      (i32.const 4))))
+
+;; Copy the characters of $str to $mem_ptr; returns the position just past
+;; the copied characters.
+(func $copyStr (param $mem_ptr i32) (param $str i32) (result i32)
+  (local $length i32)
+  (local.get $str)
+  (call $getStringLength)
+  (local.set $length)
 
-      (local.get $mem_ptr)
-      (i32.const 1)
-      (i32.add)
-      (local.set $mem_ptr)
+  (memory.copy
+    (local.get $mem_ptr)
+    (local.get $str)
+    (local.get $length))
 
-      (local.get $index)
-      (i32.const 1)
-      (i32.add)
-      (local.set $index)
+  ;; Return the position after the copied characters
+  (i32.add
+    (local.get $mem_ptr)
+    (local.get $length)))
 
-      ;; Continue the loop
-      (br $loop)))
-  ;; Return the calculated length
-  (local.get $mem_ptr))
+;; Write $char to $mem_ptr; returns the position just past it.
+(func $copyChar (param $mem_ptr i32) (param $char i32) (result i32)
+  (i32.store8
+    (local.get $mem_ptr)
+    (local.get $char))
+  (i32.add
+    (local.get $mem_ptr)
+    (i32.const 1)))
 
 (func $addTwo_str (param $str1 i32) (param $str2 i32) (result i32)
-  (global.get $_free) ;; Save starting point to return
+  (local $res_val i32)   ;; Return value
 
   (local.get $str1)
   (call $getStringLength)
@@ -97,26 +411,90 @@
 
   (i32.add)
   (call $_str_alloc)
-  
+  (local.tee $res_val)
+
   (local.get $str1)
   (call $copyStr)
 
   (local.get $str2)
   (call $copyStr)
 
-  (drop))
+  (drop)
+  (local.get $res_val))
 
+;; Single-character strings are never allocated: all 256 of them live in a
+;; static table at $_char_strings, 12 bytes apart. They're static, so
+;; indexed assignment copies them rather than writing to the table.
 (func $charTo_str (param $char i32) (result i32)
-  (global.get $_free) ;; Save starting point to return
-  
-  (i32.const 1)
-  (call $_str_alloc)
-
-  (local.get $char)
-
-
-  (i32.store8)
-)
+  (i32.add
+    (global.get $_char_strings)
+    (i32.mul
+      (i32.and (local.get $char) (i32.const 0xff))
+      (i32.const 12))))
+
+;; Return the address of the $len characters of $str starting at $start.
+;; Ranges that don't fit inside $str trap.
+(func $_slice (param $str i32) (param $start i32) (param $len i32) (result i32)
+  (i32.or
+    (i32.lt_s (local.get $start) (i32.const 0))
+    (i32.lt_s (local.get $len) (i32.const 0)))
+  (if
+    (then (unreachable)))
+  (i32.gt_u
+    (i32.add (local.get $start) (local.get $len))
+    (call $getStringLength (local.get $str)))
+  (if
+    (then (unreachable)))
+  (i32.add (local.get $str) (local.get $start)))
+
+;; Compare the $len bytes at $ptr1 and $ptr2.
+(func $_mem_eq (param $ptr1 i32) (param $ptr2 i32) (param $len i32) (result i32)
+  (local $i i32)
+  (block $exit
+    (loop $compare_loop
+      (i32.ge_u (local.get $i) (local.get $len))
+      (br_if $exit)
+      (i32.ne
+        (i32.load8_u (i32.add (local.get $ptr1) (local.get $i)))
+        (i32.load8_u (i32.add (local.get $ptr2) (local.get $i))))
+      (if
+        (then (return (i32.const 0))))
+      (i32.add (local.get $i) (i32.const 1))
+      (local.set $i)
+      (br $compare_loop)))
+  (i32.const 1))
+
+;; Return the $len characters of $str starting at $start. Ranges that don't
+;; fit inside $str trap. The result never shares a heap string with $str, so
+;; writing to it can't change $str. All of a static string, or a single
+;; character, is returned as a static string without copying; indexed
+;; assignment copies those before writing to them.
+(func $substr (param $str i32) (param $start i32) (param $len i32) (result i32)
+  (local $res_val i32)   ;; Return value
+  (drop
+    (call $_slice (local.get $str) (local.get $start) (local.get $len)))
+
+  (i32.and
+    (i32.eq
+      (local.get $len)
+      (call $getStringLength (local.get $str)))
+    (i32.eqz (i32.load (i32.sub (local.get $str) (i32.const 8)))))
+  (if
+    (then (return (local.get $str))))
+  (i32.eq (local.get $len) (i32.const 1))
+  (if
+    (then
+      (return
+        (call $charTo_str
+          (i32.load8_u
+            (i32.add (local.get $str) (local.get $start)))))))
+
+  (call $_str_alloc (local.get $len))
+  (local.tee $res_val)
+  (i32.add (local.get $str) (local.get $start))
+  (local.get $len)
+  (memory.copy)
+  (local.get $res_val))
 
 (func $char_at (param $str i32) (param $index i32) (result i32)
   (local.get $str)
@@ -133,6 +511,11 @@
   (local $len2 i32)
   (local $i i32)
 
+  ;; The same string is always equal to itself
+  (i32.eq (local.get $str1) (local.get $str2))
+  (if
+    (then (return (i32.const 1))))
+
   (local.get $str1)
   (call $getStringLength)
   (local.set $len1)
@@ -140,7 +523,8 @@
   (local.get $str2)
   (call $getStringLength)
   (local.set $len2)
-  
+
+  ;; Strings of different lengths can't be equal
   (i32.ne (local.get $len1) (local.get $len2))
 
   (if 
@@ -161,76 +545,135 @@
   (return (i32.const 1))
 )
 
+;; Raise $base to the power $exp by repeated squaring, wrapping around like
+;; i32.mul. Negative powers are 1 / $base ** -$exp rounded towards zero.
+(func $_pow_i32 (param $base i32) (param $exp i32) (result i32)
+  (local $result i32)
+  (i32.lt_s (local.get $exp) (i32.const 0))
+  (if
+    (then
+      ;; only 1 and -1 have a reciprocal that isn't rounded to 0
+      (i32.eq (local.get $base) (i32.const 1))
+      (if
+        (then (return (i32.const 1))))
+      (i32.eq (local.get $base) (i32.const -1))
+      (if
+        (then
+          (return
+            (select
+              (i32.const -1)
+              (i32.const 1)
+              (i32.and (local.get $exp) (i32.const 1))))))
+      (return (i32.const 0))))
+
+  (local.set $result (i32.const 1))
+  (block $exit
+    (loop $square_loop
+      (i32.eqz (local.get $exp))
+      (br_if $exit)
+      (i32.and (local.get $exp) (i32.const 1))
+      (if
+        (then
+          (local.set $result
+            (i32.mul (local.get $result) (local.get $base)))))
+      (local.set $base (i32.mul (local.get $base) (local.get $base)))
+      (local.set $exp (i32.shr_u (local.get $exp) (i32.const 1)))
+      (br $square_loop)))
+  (local.get $result))
+
+;; Raise $base to the power $exp by repeated squaring. Negative powers are
+;; 1 / $base ** -$exp.
+(func $_pow_f64 (param $base f64) (param $exp i32) (result f64)
+  (local $result f64)
+  (local $negative i32)
+  (local.set $negative (i32.lt_s (local.get $exp) (i32.const 0)))
+  (local.get $negative)
+  (if
+    (then
+      ;; -$exp is read as unsigned, so even the lowest int works
+      (local.set $exp (i32.sub (i32.const 0) (local.get $exp)))))
+
+  (local.set $result (f64.const 1))
+  (block $exit
+    (loop $square_loop
+      (i32.eqz (local.get $exp))
+      (br_if $exit)
+      (i32.and (local.get $exp) (i32.const 1))
+      (if
+        (then
+          (local.set $result
+            (f64.mul (local.get $result) (local.get $base)))))
+      (local.set $base (f64.mul (local.get $base) (local.get $base)))
+      (local.set $exp (i32.shr_u (local.get $exp) (i32.const 1)))
+      (br $square_loop)))
+
+  (local.get $negative)
+  (if (result f64)
+    (then (f64.div (f64.const 1) (local.get $result)))
+    (else (local.get $result))))
+
 (func $multply_char (param $char i32) (param $times i32) (result i32)
   (local $res_val i32)   ;; Return value
-  (local $mem_ptr i32)
 
   (local.get $times)
   (call $_str_alloc)
+  (local.tee $res_val)
 
-  (local.tee $mem_ptr)
-  (local.set $res_val)
-  (block $exit1 ;; Outer block
-    (loop $loop
-      (local.get $times)
-      (i32.eqz)        
-      (br_if $exit1)
-
-      (local.get $mem_ptr)
-      (local.get $char)
-      (i32.store8)
-
-      (local.get $mem_ptr)
-      (i32.const 1)
-      (i32.add)
-      (local.set $mem_ptr)
-
-      (local.get $times)
-      (i32.const 1)
-      (i32.sub)
-      (local.set $times)
-      
-      ;; Continue the loop
-      (br $loop)))
+  (local.get $char)
+  (local.get $times)
+  (memory.fill)
 
   (local.get $res_val))
 
 (func $multply_str (param $str i32) (param $times i32) (result i32)
   (local $res_val i32)   ;; Return value
-  (local $mem_ptr i32)
+  (local $total i32)     ;; Length of the result
+  (local $filled i32)    ;; Number of bytes of the result written so far
 
   (local.get $str)
   (call $getStringLength)
-
   (local.get $times)
-  
   (i32.mul)
+  (local.tee $total)
   (call $_str_alloc)
-
-  (local.set $mem_ptr)
-  (local.get $mem_ptr)
   (local.set $res_val)  ;;Assigning return value
 
+  (i32.eqz (local.get $total))
+  (if
+    (then (return (local.get $res_val))))
+
+  ;; Write the first copy, then keep doubling what we've written so far
+  (local.get $res_val)
+  (local.get $str)
+  (call $copyStr)
+  (local.get $res_val)
+  (i32.sub)
+  (local.set $filled)
+
   (block $exit1 ;; Outer block
     (loop $loop
-      (local.get $times)
-      (i32.eqz)        
+      (i32.gt_u
+        (i32.shl (local.get $filled) (i32.const 1))
+        (local.get $total))
       (br_if $exit1)
 
-      (local.get $mem_ptr)
-      (local.get $str)
-      (call $copyStr)
+      (memory.copy
+        (i32.add (local.get $res_val) (local.get $filled))
+        (local.get $res_val)
+        (local.get $filled))
 
-      (local.set $mem_ptr)
+      (i32.shl (local.get $filled) (i32.const 1))
+      (local.set $filled)
 
-      (local.get $times)
-      (i32.const 1)
-      (i32.sub)
-      (local.set $times)
-      
       ;; Continue the loop
       (br $loop)))
 
+  ;; Copy whatever is left over from the front of the result
+  (memory.copy
+    (i32.add (local.get $res_val) (local.get $filled))
+    (local.get $res_val)
+    (i32.sub (local.get $total) (local.get $filled)))
+
   (local.get $res_val))
 
 (func $index_str (param $str i32) (param $index i32) (result i32)
@@ -253,4 +696,32 @@
     (local.get $index)
     (local.get $char))
 
-  (local.get $char))
\ No newline at end of file
+  (local.get $char))
+
+;; Trap unless $index is inside $str. Negative indexes are huge unsigned, so
+;; one comparison covers both ends.
+(func $_check_index (param $str i32) (param $index i32)
+  (i32.ge_u
+    (local.get $index)
+    (call $getStringLength (local.get $str)))
+  (if
+    (then (unreachable))))
+
+;; Versions of the three functions above for --checked-indexing.
+(func $index_str_checked (param $str i32) (param $index i32) (result i32)
+  (call $_check_index (local.get $str) (local.get $index))
+  (call $index_str (local.get $str) (local.get $index)))
+
+(func $assign_index_checked (param $str i32) (param $index i32) (param $char i32)
+  (call $_check_index (local.get $str) (local.get $index))
+  (call $assign_index
+    (local.get $str)
+    (local.get $index)
+    (local.get $char)))
+
+(func $assign_index_chain_checked (param $str i32) (param $index i32) (param $char i32) (result i32)
+  (call $_check_index (local.get $str) (local.get $index))
+  (call $assign_index_chain
+    (local.get $str)
+    (local.get $index)
+    (local.get $char)))
\ No newline at end of file
@@ -0,0 +1,78 @@
+;; SIMD128 versions of string runtime functions in internal.wat.
+;; When compiling with --simd, each function here replaces the function of
+;; the same name from internal.wat, so signatures must match exactly.
+
+(func $str_eq (param $str1 i32) (param $str2 i32) (result i32)
+  (local $len i32)
+  (local $i i32)
+
+  ;; The same string is always equal to itself
+  (i32.eq (local.get $str1) (local.get $str2))
+  (if
+    (then (return (i32.const 1))))
+
+  (local.get $str1)
+  (call $getStringLength)
+  (local.set $len)
+
+  ;; Strings of different lengths can't be equal
+  (i32.ne (local.get $len) (call $getStringLength (local.get $str2)))
+  (if
+    (then (return (i32.const 0))))
+
+  ;; Compare 16 bytes at a time. Blocks never extend past the end of the
+  ;; strings, so we can't read past the end of memory.
+  (block $exit
+    (loop $block_loop
+      (i32.gt_u
+        (i32.add (local.get $i) (i32.const 16))
+        (local.get $len))
+      (br_if $exit)
+      (i8x16.all_true
+        (i8x16.eq
+          (v128.load (i32.add (local.get $str1) (local.get $i)))
+          (v128.load (i32.add (local.get $str2) (local.get $i)))))
+      (i32.eqz)
+      (if
+        (then (return (i32.const 0))))
+      (i32.add (local.get $i) (i32.const 16))
+      (local.set $i)
+      (br $block_loop)))
+
+  ;; Nothing left over
+  (i32.eq (local.get $i) (local.get $len))
+  (if
+    (then (return (i32.const 1))))
+
+  ;; Strings of at least 16 bytes finish with one last block that overlaps
+  ;; the bytes we've already compared
+  (i32.ge_u (local.get $len) (i32.const 16))
+  (if
+    (then
+      (return
+        (i8x16.all_true
+          (i8x16.eq
+            (v128.load
+              (i32.sub
+                (i32.add (local.get $str1) (local.get $len))
+                (i32.const 16)))
+            (v128.load
+              (i32.sub
+                (i32.add (local.get $str2) (local.get $len))
+                (i32.const 16))))))))
+
+  ;; Shorter strings are compared a byte at a time
+  (block $tail_exit
+    (loop $tail_loop
+      (i32.ge_u (local.get $i) (local.get $len))
+      (br_if $tail_exit)
+      (i32.ne
+        (i32.load8_u (i32.add (local.get $str1) (local.get $i)))
+        (i32.load8_u (i32.add (local.get $str2) (local.get $i))))
+      (if
+        (then (return (i32.const 0))))
+      (i32.add (local.get $i) (i32.const 1))
+      (local.set $i)
+      (br $tail_loop)))
+  (return (i32.const 1))
+)
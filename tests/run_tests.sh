@@ -3,11 +3,17 @@
 # Initialize a counter for differing files
 wat_count=0
 wasm_count=0
-test_count=20
+test_count=38
 
 error_pass_count=0
 error_fail_count=0
-error_test_count=11
+error_test_count=14
+
+# Tests that are also compiled with a compiler option, as test-NN-option.wasm
+option_wat_count=0
+option_wasm_count=0
+option_tests="25:simd 26:tail-calls 28:memoize 35:checked-indexing"
+option_test_count=$(echo $option_tests | wc -w)
 
 P3_wat_count=0
 P3_wasm_count=0
@@ -45,7 +51,7 @@ for i in $(seq -w 01 $test_count); do
 
     # Double check that WAT file was generated; convert it to WASM
     if [[ -f "$wat_file" ]]; then
-        wat2wasm "$wat_file"
+        wat2wasm --enable-bulk-memory "$wat_file"
     else
         echo "File '$wat_file' does not exist."
         continue
@@ -67,6 +73,60 @@ for i in $(seq -w 01 $test_count); do
     fi
 done
 
+echo ---
+echo OPTION Testing
+
+# Loop through the tests to compile again with an option
+for option_test in $option_tests; do
+    # Set the file names
+    i=${option_test%%:*}
+    option=${option_test#*:}
+    code_file="test-${i}.tube"
+    wat_file="test-${i}-${option}.wat"
+    wasm_file="test-${i}-${option}.wasm"
+
+    # Use Project4 to generate the WAT file with the option.
+    if [[ -f "../Project4" && -f "$code_file" ]]; then
+        ../Project4 "--${option}" "$code_file" > "$wat_file"
+    else
+        echo "Executable ../Project4 or code file $code_file does not exist."
+        continue
+    fi
+
+    if [ $? -ne 0 ]; then
+        echo "Compilation of test $i with --${option} to WAT format FAILED."
+        rm -f "$wat_file"
+        continue
+    else
+        ((option_wat_count++))
+        echo "Compilation of test $i with --${option} to WAT format SUCCESSFUL."
+    fi
+
+    # Double check that WAT file was generated; convert it to WASM. Options
+    # may use SIMD or tail calls, so enable every feature.
+    if [[ -f "$wat_file" ]]; then
+        wat2wasm --enable-all "$wat_file"
+    else
+        echo "File '$wat_file' does not exist."
+        continue
+    fi
+
+    if [ $? -ne 0 ]; then
+        echo "                   ... to WASM format FAILED."
+        rm -f "$wasm_file"
+        continue
+    else
+        echo "                   ... to WASM format SUCCESSFUL."
+    fi
+
+    # Make sure WASM file was generated
+    if [[ -f "$wasm_file" ]]; then
+        ((option_wasm_count++))
+    else
+        echo "File '$wasm_file' does not exist."
+    fi
+done
+
 echo ---
 echo PROJECT 3 Testing
 
@@ -96,7 +156,7 @@ for i in $(seq -w 01 $P3_test_count); do
 
     # Double check that WAT file was generated; convert it to WASM
     if [[ -f "$wat_file" ]]; then
-        wat2wasm "$wat_file"
+        wat2wasm --enable-bulk-memory "$wat_file"
     else
         echo "File '$wat_file' does not exist."
         continue
@@ -177,6 +237,9 @@ echo ---
 echo "Of $test_count regular test files..."
 echo "...generated $wat_count WAT files"
 echo "...converted $wasm_count WAT files to wasm files for testing."
+echo "Of $option_test_count tests compiled with options..."
+echo "...generated $option_wat_count WAT files"
+echo "...converted $option_wasm_count WAT files to wasm files for testing."
 echo "Of $P3_test_count Project 3 tests (that need to still work)..."
 echo "...generated $P3_wat_count WAT files"
 echo "...converted $P3_wasm_count WAT files to wasm files for testing."
@@ -19,6 +19,21 @@ template <typename T> std::string Quote(T in) {
   return '"' + std::string{in} + '"';
 }
 
+// quote arbitrary bytes as a WAT string, escaping anything unprintable
+inline std::string QuoteBytes(std::string const &bytes) {
+  std::stringstream out;
+  out << '"' << std::hex;
+  for (unsigned char byte : bytes) {
+    if (byte >= 0x20 && byte < 0x7f && byte != '"' && byte != '\\') {
+      out << byte;
+    } else {
+      out << '\\' << (byte < 0x10 ? "0" : "") << static_cast<int>(byte);
+    }
+  }
+  out << '"';
+  return out.str();
+}
+
 template <typename... T> std::string Variable(T... components) {
   std::stringstream out{};
   out << "$";